@@ -0,0 +1,242 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+#include "allocprof.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "object.h"
+#include "vm.h"
+
+#define ALLOC_MAX_LOAD 0.75
+// Long enough for the deepest call stack, with room to spare for long function names
+#define ALLOC_MAX_STACK (FRAMES_MAX * 48)
+
+static const char* typeName(int type) {
+    switch (type) {
+        case OBJ_STRING: return "string";
+        case OBJ_FUNCTION: return "function";
+        case OBJ_INSTANCE: return "instance";
+        case OBJ_NATIVE: return "native";
+        case OBJ_CLOSURE: return "closure";
+        case OBJ_UPVALUE: return "upvalue";
+        case OBJ_CLASS: return "class";
+        case OBJ_BOUND_METHOD: return "bound method";
+        case OBJ_ROPE: return "rope";
+        case OBJ_WEAK_REF: return "weak ref";
+        case OBJ_WEAK_MAP: return "weak map";
+        default: return "array";
+    }
+}
+
+void initAllocProfile(AllocProfile* profile) {
+    profile->enabled = false;
+    profile->sampleInterval = 0;
+    profile->untilSample = 0;
+    profile->random = 0x9e3779b97f4a7c15;
+    profile->records = NULL;
+    profile->count = 0;
+    profile->capacity = 0;
+}
+
+void freeAllocProfile(AllocProfile* profile) {
+    for (int i = 0; i < profile->capacity; i++) {
+        free(profile->records[i].stack);
+    }
+    free(profile->records);
+    initAllocProfile(profile);
+}
+
+// Uniform over [1, 2 * sampleInterval], so samples are sampleInterval apart on average
+static int64_t nextSample(AllocProfile* profile) {
+    profile->random ^= profile->random << 13;
+    profile->random ^= profile->random >> 7;
+    profile->random ^= profile->random << 17;
+    return 1 + (int64_t)(profile->random % (2 * profile->sampleInterval));
+}
+
+void startAllocProfile(AllocProfile* profile, size_t sampleInterval) {
+    profile->enabled = true;
+    profile->sampleInterval = sampleInterval;
+    if (sampleInterval > 0) profile->untilSample = nextSample(profile);
+}
+
+static inline uint64_t mix(uint64_t hash, uint64_t value) {
+    hash = (hash ^ value) * 0xff51afd7ed558ccd;
+    return hash ^ (hash >> 32);
+}
+
+static int frameLine(CallFrame* frame, ObjFunction* function) {
+    // ip has already moved past the instruction that is running
+    return getLine(&function->chunk, (int)(frame->ip - function->chunk.code - 1));
+}
+
+// Names the function a frame is running, the way stack traces do
+static const char* frameName(ObjFunction* function, uint32_t* hash) {
+    ObjString* name = LOAD_REF(ObjString, function->name);
+    if (name == NULL) {
+        *hash = 0;
+        return "script";
+    }
+    *hash = name->hash;
+    return name->chars;
+}
+
+// Functions can move or be collected while the profile is still around, so stacks are told apart by function name
+// and line rather than by the functions themselves. Records go by this hash alone, without comparing the stacks, as
+// two stacks colliding in 64 bits is too unlikely to matter to a profile.
+static uint64_t stackKey(int type) {
+    uint64_t key = mix(0x2545f4914f6cdd1d, (uint64_t)(type + 2));
+    for (int i = 0; i < vm.frameCount; i++) {
+        ObjFunction* function = LOAD_REF(ObjFunction, vm.frames[i].closure->function);
+        uint32_t hash;
+        frameName(function, &hash);
+        key = mix(key, (uint64_t)hash << 32 | (uint32_t)frameLine(&vm.frames[i], function));
+    }
+    // 0 marks an empty slot
+    return key == 0 ? 1 : key;
+}
+
+static AllocRecord* findRecord(AllocRecord* records, int capacity, uint64_t key) {
+    uint64_t index = key & (capacity - 1);
+    while (records[index].key != 0 && records[index].key != key) {
+        index = (index + 1) & (capacity - 1);
+    }
+    return &records[index];
+}
+
+static void growRecords(AllocProfile* profile) {
+    int capacity = profile->capacity == 0 ? 64 : profile->capacity * 2;
+    AllocRecord* records = calloc(capacity, sizeof(AllocRecord));
+    if (records == NULL) exit(1);
+    for (int i = 0; i < profile->capacity; i++) {
+        if (profile->records[i].key == 0) continue;
+        *findRecord(records, capacity, profile->records[i].key) = profile->records[i];
+    }
+    free(profile->records);
+    profile->records = records;
+    profile->capacity = capacity;
+}
+
+// Collapses the running call stack, outermost frame first, followed by the type
+static void describeStack(AllocRecord* record) {
+    char stack[ALLOC_MAX_STACK];
+    int length = 0;
+    int site = 0;
+    if (vm.frameCount == 0) {
+        // Nothing is running yet, so it's the compiler allocating
+        length = snprintf(stack, sizeof(stack), "(compile);");
+    }
+    for (int i = 0; i < vm.frameCount && length < (int)sizeof(stack); i++) {
+        ObjFunction* function = LOAD_REF(ObjFunction, vm.frames[i].closure->function);
+        uint32_t hash;
+        site = length;
+        length += snprintf(stack + length, sizeof(stack) - length, "%s:%d;",
+                           frameName(function, &hash), frameLine(&vm.frames[i], function));
+    }
+    if (length < (int)sizeof(stack)) snprintf(stack + length, sizeof(stack) - length, "%s", typeName(record->type));
+
+    record->stack = strdup(stack);
+    if (record->stack == NULL) exit(1);
+    record->site = site;
+}
+
+void profileAllocation(AllocProfile* profile, int type, size_t size) {
+    // The collector's own allocations aren't anything the script did
+    if (vm.collecting || size == 0) return;
+
+    uint64_t bytes = size;
+    if (profile->sampleInterval > 0) {
+        profile->untilSample -= (int64_t)size;
+        if (profile->untilSample > 0) return;
+        // Each sample stands for the bytes since the last one. A big allocation can cover several.
+        uint64_t samples = 0;
+        while (profile->untilSample <= 0) {
+            samples++;
+            profile->untilSample += nextSample(profile);
+        }
+        bytes = samples * profile->sampleInterval;
+    }
+
+    if (profile->count + 1 > profile->capacity * ALLOC_MAX_LOAD) growRecords(profile);
+    uint64_t key = stackKey(type);
+    AllocRecord* record = findRecord(profile->records, profile->capacity, key);
+    if (record->key == 0) {
+        record->key = key;
+        record->type = type;
+        record->count = 0;
+        record->bytes = 0;
+        describeStack(record);
+        profile->count++;
+    }
+    record->bytes += bytes;
+    // When sampling, the number of allocations is an estimate too
+    record->count += bytes / size > 0 ? bytes / size : 1;
+}
+
+static int compareSites(const void* a, const void* b) {
+    const AllocRecord* left = a;
+    const AllocRecord* right = b;
+    int order = strcmp(left->stack + left->site, right->stack + right->site);
+    if (order != 0) return order;
+    return left->type - right->type;
+}
+
+static int compareBytes(const void* a, const void* b) {
+    const AllocRecord* left = a;
+    const AllocRecord* right = b;
+    if (left->bytes != right->bytes) return left->bytes < right->bytes ? 1 : -1;
+    return 0;
+}
+
+void printAllocReport(AllocProfile* profile, FILE* out) {
+    // Stacks ending in the same frame and type add up to one site
+    AllocRecord* sites = malloc(sizeof(AllocRecord) * (profile->count + 1));
+    if (sites == NULL) exit(1);
+    int count = 0;
+    uint64_t totalBytes = 0;
+    for (int i = 0; i < profile->capacity; i++) {
+        if (profile->records[i].key != 0) sites[count++] = profile->records[i];
+    }
+    qsort(sites, count, sizeof(AllocRecord), compareSites);
+    int merged = 0;
+    for (int i = 0; i < count; i++) {
+        totalBytes += sites[i].bytes;
+        if (merged > 0 && compareSites(&sites[merged - 1], &sites[i]) == 0) {
+            sites[merged - 1].bytes += sites[i].bytes;
+            sites[merged - 1].count += sites[i].count;
+        } else {
+            sites[merged++] = sites[i];
+        }
+    }
+    qsort(sites, merged, sizeof(AllocRecord), compareBytes);
+
+    if (profile->sampleInterval > 0) {
+        fprintf(out, "Allocations, sampled every %zu bytes on average:\n", profile->sampleInterval);
+    } else {
+        fprintf(out, "Allocations:\n");
+    }
+    fprintf(out, "  %12s %6s %10s  %-12s %s\n", "bytes", "%", "count", "type", "site");
+    for (int i = 0; i < merged && i < ALLOC_REPORT_SITES; i++) {
+        AllocRecord* site = &sites[i];
+        // The site is the innermost frame, without the ';' and type that follow it
+        const char* frame = site->stack + site->site;
+        const char* frameEnd = strchr(frame, ';');
+        int frameLength = frameEnd != NULL ? (int)(frameEnd - frame) : (int)strlen(frame);
+        fprintf(out, "  %12llu %5.1f%% %10llu  %-12s %.*s\n", (unsigned long long)site->bytes,
+                totalBytes > 0 ? 100.0 * site->bytes / totalBytes : 0.0, (unsigned long long)site->count,
+                typeName(site->type), frameLength, frame);
+    }
+    if (merged > ALLOC_REPORT_SITES) fprintf(out, "  ... and %d more sites\n", merged - ALLOC_REPORT_SITES);
+    fprintf(out, "  %12llu bytes in total\n", (unsigned long long)totalBytes);
+    free(sites);
+}
+
+void writeAllocStacks(AllocProfile* profile, FILE* out) {
+    for (int i = 0; i < profile->capacity; i++) {
+        AllocRecord* record = &profile->records[i];
+        if (record->key != 0) fprintf(out, "%s %llu\n", record->stack, (unsigned long long)record->bytes);
+    }
+}
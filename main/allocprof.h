@@ -0,0 +1,64 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * The allocation profiler, which tells which lines of a script are allocating what. Each allocation is put down to
+ * the kind of object it made, and to the call stack it was made from, one function and line per frame. Memory that
+ * isn't an object, like the characters of a string or the entries of a table, counts as an array.
+ *
+ * Recording every allocation means walking the whole call stack every time, so for long running scripts the profiler
+ * can sample instead: it then records one allocation every so many bytes, picked at random so that it doesn't fall in
+ * step with a loop, and scales each sample up to the bytes it stands for.
+ *
+ * Results come out as a report of the sites that allocated the most, and optionally as collapsed stacks, one
+ * "frame;frame;type bytes" line per stack, which flamegraph.pl and its kin take as they are.
+ */
+#ifndef clox_allocprof_h
+#define clox_allocprof_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+// The type recorded for anything that went through reallocate() rather than allocateObject()
+#define ALLOC_ARRAY (-1)
+// How many sites the report lists
+#define ALLOC_REPORT_SITES 40
+
+typedef struct {
+    // Identifies the stack and type, 0 for an empty slot
+    uint64_t key;
+    int type;
+    // The collapsed stack, ending with the type
+    char* stack;
+    // Where in stack the innermost frame starts
+    int site;
+    uint64_t count;
+    uint64_t bytes;
+} AllocRecord;
+
+typedef struct {
+    bool enabled;
+    // 0 to record every allocation, otherwise the average number of bytes between samples
+    size_t sampleInterval;
+    // Bytes left until the next sample
+    int64_t untilSample;
+    uint64_t random;
+    // Open addressing, keyed by AllocRecord.key
+    AllocRecord* records;
+    int count;
+    int capacity;
+} AllocProfile;
+
+void initAllocProfile(AllocProfile* profile);
+void freeAllocProfile(AllocProfile* profile);
+// Starts recording allocations from here on
+void startAllocProfile(AllocProfile* profile, size_t sampleInterval);
+// Records an allocation of 'size' bytes of 'type' (an ObjType or ALLOC_ARRAY), made by whatever the VM is running
+void profileAllocation(AllocProfile* profile, int type, size_t size);
+// The sites that allocated the most bytes, each function and line with the type it allocated
+void printAllocReport(AllocProfile* profile, FILE* out);
+void writeAllocStacks(AllocProfile* profile, FILE* out);
+
+#endif
@@ -5,14 +5,19 @@
 #include <stdlib.h>
 #include "chunk.h"
 #include "memory.h"
+#include "handles.h"
+#include "stackmap.h"
 #include "vm.h"
 
 void initChunk(Chunk* chunk) {
     chunk->count = 0;
     chunk->capacity = 0;
     chunk->code = NULL;
+    chunk->lineCount = 0;
+    chunk->lineCapacity = 0;
     chunk->lines = NULL;
     initValueArray(&chunk->constants);
+    initStackMap(&chunk->stackMap);
 }
 
 void writeChunk(Chunk* chunk, uint8_t byte, int line) {
@@ -20,30 +25,55 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
         int oldCapacity = chunk->capacity;
         chunk->capacity = GROW_CAPACITY(oldCapacity);
         chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-        //naive and inefficient method of keeping track of lines that generated this bytecode, TODO change implementation
-        chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
     }
 
     chunk->code[chunk->count] = byte;
-    chunk->lines[chunk->count] = line;
     chunk->count++;
+
+    // Most lines compile to several bytes, and only the first of them gets an entry
+    if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) return;
+    if (chunk->lineCapacity < chunk->lineCount + 1) {
+        int oldCapacity = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->lines = GROW_ARRAY(LineStart, chunk->lines, oldCapacity, chunk->lineCapacity);
+    }
+    LineStart* lineStart = &chunk->lines[chunk->lineCount++];
+    lineStart->offset = chunk->count - 1;
+    lineStart->line = line;
 }
 
 void freeChunk(Chunk* chunk) {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
     freeValueArray(&chunk->constants);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    freeStackMap(&chunk->stackMap);
     initChunk(chunk);
 }
 
+int getLine(Chunk* chunk, int offset) {
+    // Binary search for the last line starting at or before offset
+    int low = 0;
+    int high = chunk->lineCount - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (chunk->lines[mid].offset > offset) {
+            high = mid - 1;
+        } else {
+            low = mid;
+        }
+    }
+    return chunk->lines[low].line;
+}
+
 // Returns the index where the given value was appended
 int addConstant(Chunk* chunk, Value value) {
     // Each chunk owns a constant table, which is a dynamic array. That might need to grow and call
     // reallocate, which can trigger a gc. That gc may sweep up "value" even though we still need it.
-    // Popping it onto the stack before we try to reallocate fixes this.
-    push(value);
-    writeValueArray(&chunk->constants, value);
-    pop(value);
+    // Holding it through a handle while we reallocate fixes this.
+    HandleScope scope = openHandleScope();
+    Handle constant = newHandle(value);
+    writeValueArray(&chunk->constants, *constant);
+    closeHandleScope(scope);
     return chunk->constants.count - 1;
 }
 
@@ -47,17 +47,50 @@ typedef enum {
     OP_INVOKE,
 } OpCode;
 
+// Where the code for a line begins. A line's code runs up to where the next entry's begins.
+typedef struct {
+    int offset;
+    int line;
+} LineStart;
+
+// An instruction during which the GC may run, and the locals in scope there that the function never reads again
+typedef struct {
+    int start;
+    int end;
+    // Where the slot numbers of those locals begin in StackMap.deadSlots, and how many there are
+    int deadStart;
+    int deadCount;
+} StackMapEntry;
+
+// Only instructions with some dead locals get an entry, ordered by offset
+typedef struct {
+    int count;
+    int capacity;
+    StackMapEntry* entries;
+    int slotCount;
+    int slotCapacity;
+    uint8_t* deadSlots;
+} StackMap;
+
 typedef struct {
     int count;
     int capacity;
     uint8_t *code;
-    int* lines;
+    // Run length encoded, one entry every time the line changes. Only errors, the disassembler and the profiling
+    // tools ever read it.
+    int lineCount;
+    int lineCapacity;
+    LineStart* lines;
     ValueArray constants;
+    // Filled in by the compiler once the code is done, see stackmap.h
+    StackMap stackMap;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 void freeChunk(Chunk* chunk);
 int addConstant(Chunk* chunk, Value value);
+// The source line the byte at 'offset' was compiled from
+int getLine(Chunk* chunk, int offset);
 
 #endif
\ No newline at end of file
@@ -18,6 +18,18 @@
 // Option for logging whenever we do something with dynamic memory (allocation, free, etc)
 #define DEBUG_LOG_GC
 
+// Count every instruction run() dispatches by opcode, pair and site, and time each opcode, reported on exit.
+// Leave it out for anything but picking what to optimize in the interpreter loop, as it slows every instruction down.
+//#define DEBUG_OPCODE_STATS
+
+// Back big heaps with transparent huge pages, for fewer TLB misses. Empty regions are still given back to the OS,
+// which splits the huge page they sit in.
+//#define HEAP_HUGE_PAGES
+
+// Store references between objects as 32 bit offsets into a 4 GB reservation, instead of 8 byte pointers. Shrinks
+// upvalues and closures, at the cost of an add on every such reference.
+//#define HEAP_COMPRESSED_REFS
+
 #define UINT8_COUNT (UINT8_MAX + 1)
 
 #endif
\ No newline at end of file
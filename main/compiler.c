@@ -12,6 +12,7 @@
 #include "chunk.h"
 #include "debug.h"
 #include "memory.h"
+#include "stackmap.h"
 #include "value.h"
 
 // A parser takes a list of
@@ -53,6 +54,8 @@ typedef struct {
     Token name;
     int depth;
     bool isCaptured;
+    // Where in the code the local got its value
+    int start;
 } Local;
 
 // Struct that represents upvalues;
@@ -81,6 +84,10 @@ typedef struct Compiler{
     int scopeDepth;
     // Simpler to have a (large) fixed amount of upvalues
     Upvalue upvalues[UINT8_COUNT];
+    // Where every local that has gone out of scope so far was in scope, for the stack map
+    LocalRange* ranges;
+    int rangeCount;
+    int rangeCapacity;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -212,11 +219,25 @@ static void beginScope() {
     current->scopeDepth++;
 }
 
+static void addLocalRange(Local* local, int slot) {
+    if (local->depth == -1) return;
+    if (current->rangeCapacity < current->rangeCount + 1) {
+        int oldCapacity = current->rangeCapacity;
+        current->rangeCapacity = GROW_CAPACITY(oldCapacity);
+        current->ranges = GROW_ARRAY(LocalRange, current->ranges, oldCapacity, current->rangeCapacity);
+    }
+    LocalRange* range = &current->ranges[current->rangeCount++];
+    range->slot = slot;
+    range->start = local->start;
+    range->end = currentChunk()->count;
+}
+
 static void endScope() {
     current->scopeDepth--;
 
     while (current->localCount > 0
         && current->locals[current->localCount - 1].depth > current->scopeDepth) {
+        addLocalRange(&current->locals[current->localCount - 1], current->localCount - 1);
         if (current->locals[current->localCount - 1].isCaptured) {
             emitByte(OP_CLOSE_UPVALUE);
         } else {
@@ -229,9 +250,17 @@ static void endScope() {
 static ObjFunction* endCompiler() {
     emitReturn();
     ObjFunction* function = current->function;
+
+    // Whatever is still in scope stays there until the function returns
+    for (int i = 0; i < current->localCount; i++) {
+        addLocalRange(&current->locals[i], i);
+    }
+    if (!parser.hadError) buildStackMap(currentChunk(), current->ranges, current->rangeCount);
+    FREE_ARRAY(LocalRange, current->ranges, current->rangeCapacity);
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
-        disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");
+        ObjString* name = LOAD_REF(ObjString, function->name);
+        disassembleChunk(currentChunk(), name != NULL ? name->chars : "<script>");
     }
 #endif
 
@@ -331,18 +360,28 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
     compiler->type = type;
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
+    compiler->ranges = NULL;
+    compiler->rangeCount = 0;
+    compiler->rangeCapacity = 0;
     compiler->function = newFunction();
     current = compiler;
     if (type != TYPE_SCRIPT) {
-        current->function->name = copyString(parser.previous.start, parser.previous.length);
+        current->function->name = heapPack(copyString(parser.previous.start, parser.previous.length));
     }
 
     // Implciitly claims slot 0 of the locals slot for the vm to use (top level defs)
     Local* local = &current->locals[current->localCount++];
     local->depth = 0;
-    local->name.start = "";
-    local->name.length = 0;
+    // Methods find their receiver there, under the name 'this'
+    if (type == TYPE_METHOD || type == TYPE_INITIALIZER) {
+        local->name.start = "this";
+        local->name.length = 4;
+    } else {
+        local->name.start = "";
+        local->name.length = 0;
+    }
     local->isCaptured = false;
+    local->start = 0;
 }
 
 static void number(bool canAssign) {
@@ -427,7 +466,7 @@ ParseRule rules[] = {
   [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE},
   [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
   [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
-  [TOKEN_DOT]           = {NULL,     dot,   PREC_NONE},
+  [TOKEN_DOT]           = {NULL,     dot,   PREC_CALL},
   [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
   [TOKEN_PLUS]          = {NULL,     binary, PREC_TERM},
   [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
@@ -618,6 +657,7 @@ static void synchronize() {
             default:
                 ; // Do nothing.
         }
+        advance();
     }
 }
 
@@ -757,7 +797,11 @@ static uint8_t parseVariable(const char* message) {
 }
 
 static void markInitialized() {
+    // A function declared at the top level is a global, there is no local to mark
+    if (current->scopeDepth == 0) return;
     current->locals[current->localCount - 1].depth = current->scopeDepth;
+    // A function declaration is marked once before its body, to be able to call itself, and again after it
+    current->locals[current->localCount - 1].start = currentChunk()->count;
 }
 
 // Variables declared without an '=' are implcitly declared as NIL
@@ -833,7 +877,6 @@ static void forStatement() {
     } else {
         expressionStatement();
     }
-    consume(TOKEN_SEMICOLON, "Expected ';'");
 
     int loopStart = currentChunk()->count;
     // Conditional expression
@@ -847,7 +890,6 @@ static void forStatement() {
         emitByte(OP_POP);
 
     }
-    consume(TOKEN_SEMICOLON, "Expected ';'");
     // The increment statement. This is convoluted because it is declared before the loop body but executed
     // afterwards, and our compiler is single pass. Deal with it.
     if (!match(TOKEN_RIGHT_PAREN)) {
@@ -858,12 +900,13 @@ static void forStatement() {
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses");
 
         emitLoop(loopStart);
+        loopStart = incrementStart;
         patchJump(bodyJump);
     }
 
     statement();
     emitLoop(loopStart);
-    if (exitJump == -1) {
+    if (exitJump != -1) {
         patchJump(exitJump);
         emitByte(OP_POP);
     }
@@ -56,14 +56,55 @@ static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
     return offset + 3;
 }
 
+const char* opcodeName(uint8_t instruction) {
+    switch (instruction) {
+        case OP_RETURN: return "OP_RETURN";
+        case OP_CLASS: return "OP_CLASS";
+        case OP_CONSTANT: return "OP_CONSTANT";
+        case OP_NIL: return "OP_NIL";
+        case OP_TRUE: return "OP_TRUE";
+        case OP_FALSE: return "OP_FALSE";
+        case OP_POP: return "OP_POP";
+        case OP_GET_LOCAL: return "OP_GET_LOCAL";
+        case OP_SET_LOCAL: return "OP_SET_LOCAL";
+        case OP_GET_GLOBAL: return "OP_GET_GLOBAL";
+        case OP_DEFINE_GLOBAL: return "OP_DEFINE_GLOBAL";
+        case OP_SET_GLOBAL: return "OP_SET_GLOBAL";
+        case OP_GET_UPVALUE: return "OP_GET_UPVALUE";
+        case OP_SET_UPVALUE: return "OP_SET_UPVALUE";
+        case OP_SET_PROPERTY: return "OP_SET_PROPERTY";
+        case OP_GET_PROPERTY: return "OP_GET_PROPERTY";
+        case OP_EQUAL: return "OP_EQUAL";
+        case OP_GREATER: return "OP_GREATER";
+        case OP_LESS: return "OP_LESS";
+        case OP_ADD: return "OP_ADD";
+        case OP_SUBTRACT: return "OP_SUBTRACT";
+        case OP_MULTIPLY: return "OP_MULTIPLY";
+        case OP_DIVIDE: return "OP_DIVIDE";
+        case OP_NEGATE: return "OP_NEGATE";
+        case OP_PRINT: return "OP_PRINT";
+        case OP_JUMP: return "OP_JUMP";
+        case OP_JUMP_IF_FALSE: return "OP_JUMP_IF_FALSE";
+        case OP_LOOP: return "OP_LOOP";
+        case OP_CALL: return "OP_CALL";
+        case OP_CLOSURE: return "OP_CLOSURE";
+        case OP_CLOSE_UPVALUE: return "OP_CLOSE_UPVALUE";
+        case OP_NOT: return "OP_NOT";
+        case OP_METHOD: return "OP_METHOD";
+        case OP_INVOKE: return "OP_INVOKE";
+        default: return "OP_UNKNOWN";
+    }
+}
+
 // Returns an integer representing the offset for the beginning of the next instruction. 
 int disassembleInstruction(Chunk* chunk, int offset) {
     printf("%04d ", offset);
 
-    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+    int line = getLine(chunk, offset);
+    if (offset > 0 && line == getLine(chunk, offset - 1)) {
         printf("    |");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -9,5 +9,7 @@
 
 void disassembleChunk(Chunk* chunk, const char* name);
 int disassembleInstruction(Chunk* chunk, int offset);
+// The opcode's name, like "OP_ADD"
+const char* opcodeName(uint8_t instruction);
 
 #endif
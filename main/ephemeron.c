@@ -0,0 +1,170 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+#include "ephemeron.h"
+
+#include "heap.h"
+#include "memory.h"
+
+#define EPHEMERON_MAX_LOAD 0.75
+#define EPHEMERON_MIN_CAPACITY 8
+// A table gets rebuilt at a load no higher than this, leaving room to grow before the next rebuild
+#define EPHEMERON_REBUILT_LOAD 0.5
+// Past these, trimming shrinks the table, or drops its tombstones
+#define EPHEMERON_MIN_LOAD 0.125
+#define EPHEMERON_MAX_TOMBSTONES 0.125
+
+// Objects sit on 16 byte boundaries, so the low bits of their address say nothing. Multiplying by an odd constant
+// moves the bits that do into the top half.
+static uint32_t hashObject(Obj* key) {
+    uint64_t bits = (uint64_t)(uintptr_t)key * 0x9e3779b97f4a7c15ull;
+    return (uint32_t)(bits >> 32);
+}
+
+void initEphemeronTable(EphemeronTable* table) {
+    table->count = 0;
+    table->live = 0;
+    table->capacity = 0;
+    table->entries = NULL;
+}
+
+void freeEphemeronTable(EphemeronTable* table) {
+    FREE_ARRAY(EphemeronEntry, table->entries, table->capacity);
+    initEphemeronTable(table);
+}
+
+// Linear probing. Returns the key's slot, or else where it would go: the first tombstone passed, or the empty slot.
+static EphemeronEntry* findEntry(EphemeronEntry* entries, int capacity, Obj* key) {
+    uint32_t index = hashObject(key) & (capacity - 1);
+    EphemeronEntry* tombstone = NULL;
+    for (;;) {
+        EphemeronEntry* entry = &entries[index];
+        if (entry->key == NULL) {
+            if (IS_NIL(entry->value)) return tombstone != NULL ? tombstone : entry;
+            if (tombstone == NULL) tombstone = entry;
+        } else if (entry->key == key) {
+            return entry;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+// Moves every entry into a fresh array of 'capacity' slots, leaving the tombstones behind
+static void adjustCapacity(EphemeronTable* table, int capacity) {
+    // Allocating can collect, which may still drop entries from the old array, so nothing is copied until after
+    EphemeronEntry* entries = ALLOCATE(EphemeronEntry, capacity);
+    for (int i = 0; i < capacity; i++) {
+        entries[i].key = NULL;
+        entries[i].value = NIL_VAL;
+    }
+
+    table->count = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        EphemeronEntry* entry = &table->entries[i];
+        if (entry->key == NULL) continue;
+        EphemeronEntry* dest = findEntry(entries, capacity, entry->key);
+        dest->key = entry->key;
+        dest->value = entry->value;
+        table->count++;
+    }
+    table->live = table->count;
+
+    FREE_ARRAY(EphemeronEntry, table->entries, table->capacity);
+    table->entries = entries;
+    table->capacity = capacity;
+}
+
+// The smallest capacity that holds 'live' entries at no more than EPHEMERON_REBUILT_LOAD
+static int rebuiltCapacity(int live) {
+    int capacity = EPHEMERON_MIN_CAPACITY;
+    while (live > capacity * EPHEMERON_REBUILT_LOAD) capacity *= 2;
+    return capacity;
+}
+
+bool ephemeronGet(EphemeronTable* table, Obj* key, Value* value) {
+    if (table->live == 0) return false;
+    EphemeronEntry* entry = findEntry(table->entries, table->capacity, key);
+    if (entry->key == NULL) return false;
+    *value = entry->value;
+    return true;
+}
+
+bool ephemeronSet(EphemeronTable* table, Obj* key, Value value) {
+    if (table->count + 1 > table->capacity * EPHEMERON_MAX_LOAD) {
+        // Sized by the entries in use rather than the tombstones too, so a table that is mostly tombstones gets
+        // rebuilt at the same size, or a smaller one, instead of doubling
+        adjustCapacity(table, rebuiltCapacity(table->live + 1));
+    }
+
+    EphemeronEntry* entry = findEntry(table->entries, table->capacity, key);
+    bool isNewKey = entry->key == NULL;
+    if (isNewKey) table->live++;
+    // Reusing a tombstone doesn't change the count, it was already in there
+    if (isNewKey && IS_NIL(entry->value)) table->count++;
+    entry->key = key;
+    entry->value = value;
+    return isNewKey;
+}
+
+bool ephemeronDelete(EphemeronTable* table, Obj* key) {
+    if (table->live == 0) return false;
+    EphemeronEntry* entry = findEntry(table->entries, table->capacity, key);
+    if (entry->key == NULL) return false;
+    entry->key = NULL;
+    entry->value = BOOL_VAL(true);
+    table->live--;
+    return true;
+}
+
+int ephemeronSize(EphemeronTable* table) {
+    return table->live;
+}
+
+bool markEphemerons(EphemeronTable* table) {
+    bool marked = false;
+    for (int i = 0; i < table->capacity; i++) {
+        EphemeronEntry* entry = &table->entries[i];
+        if (entry->key == NULL || !heapIsMarked(entry->key)) continue;
+        if (IS_OBJ(entry->value) && !heapIsMarked(AS_OBJ(entry->value))) {
+            markObject(AS_OBJ(entry->value));
+            marked = true;
+        }
+    }
+    return marked;
+}
+
+void ephemeronRemoveWhite(EphemeronTable* table) {
+    for (int i = 0; i < table->capacity; i++) {
+        EphemeronEntry* entry = &table->entries[i];
+        if (entry->key != NULL && !heapIsMarked(entry->key)) {
+            entry->key = NULL;
+            entry->value = BOOL_VAL(true);
+            table->live--;
+        }
+    }
+}
+
+void ephemeronTrim(EphemeronTable* table) {
+    if (table->capacity == 0) return;
+    if (table->live == 0) {
+        freeEphemeronTable(table);
+    } else if (table->capacity > EPHEMERON_MIN_CAPACITY && table->live < table->capacity * EPHEMERON_MIN_LOAD) {
+        adjustCapacity(table, rebuiltCapacity(table->live));
+    } else if (table->count - table->live > table->capacity * EPHEMERON_MAX_TOMBSTONES) {
+        adjustCapacity(table, table->capacity);
+    }
+}
+
+void forwardEphemerons(EphemeronTable* table) {
+    bool moved = false;
+    for (int i = 0; i < table->capacity; i++) {
+        EphemeronEntry* entry = &table->entries[i];
+        if (entry->key == NULL) continue;
+        Obj* key = heapForward(entry->key);
+        if (key != entry->key) moved = true;
+        entry->key = key;
+        if (IS_OBJ(entry->value)) entry->value.as.obj = heapForward(entry->value.as.obj);
+    }
+    if (moved) adjustCapacity(table, table->capacity);
+}
@@ -0,0 +1,49 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * A hash table keyed by object identity that doesn't keep its keys alive, behind Lox's weak maps. Each entry is an
+ * ephemeron: its value is only kept alive for as long as its key is reachable from somewhere else, so a value that
+ * refers back to its own key doesn't keep the pair around either. The GC drops the entries of dead keys.
+ */
+#ifndef clox_ephemeron_h
+#define clox_ephemeron_h
+
+#include "common.h"
+#include "value.h"
+
+typedef struct {
+    // NULL in both empty slots and tombstones, which the value tells apart
+    Obj* key;
+    Value value;
+} EphemeronEntry;
+
+typedef struct {
+    // Tombstones included
+    int count;
+    // Just the entries in use
+    int live;
+    // Always a power of two
+    int capacity;
+    EphemeronEntry* entries;
+} EphemeronTable;
+
+void initEphemeronTable(EphemeronTable* table);
+void freeEphemeronTable(EphemeronTable* table);
+bool ephemeronGet(EphemeronTable* table, Obj* key, Value* value);
+// Returns true if 'key' wasn't in the table yet
+bool ephemeronSet(EphemeronTable* table, Obj* key, Value value);
+bool ephemeronDelete(EphemeronTable* table, Obj* key);
+// How many entries are in use, not counting tombstones
+int ephemeronSize(EphemeronTable* table);
+// Helper functions for GC
+// Marks the value of every entry whose key is marked, returns whether that marked anything that wasn't already
+bool markEphemerons(EphemeronTable* table);
+void ephemeronRemoveWhite(EphemeronTable* table);
+// Clears out the tombstones dead keys leave behind, shrinking the table if it has gotten mostly empty
+void ephemeronTrim(EphemeronTable* table);
+// Points every key and value at its new home after the heap has been compacted. Keys hash by their address, so
+// the table gets rehashed if any of them moved.
+void forwardEphemerons(EphemeronTable* table);
+#endif
@@ -0,0 +1,102 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+#include "gcstats.h"
+
+#include <string.h>
+#include <time.h>
+
+void initGCStats(GCStats* stats) {
+    memset(stats, 0, sizeof(GCStats));
+    stats->startTime = gcClock();
+}
+
+uint64_t gcClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+// Pauses under eight nanoseconds get a bucket each, past that the top four bits of the pause pick its bucket
+static int pauseBucket(uint64_t pause) {
+    if (pause < (1 << GC_PAUSE_SUB_BITS)) return (int)pause;
+    int top = 63 - __builtin_clzll(pause);
+    if (top >= GC_PAUSE_MAX_BITS) return GC_PAUSE_BUCKETS - 1;
+    int shift = top - GC_PAUSE_SUB_BITS;
+    return ((shift + 1) << GC_PAUSE_SUB_BITS) + (int)((pause >> shift) & ((1 << GC_PAUSE_SUB_BITS) - 1));
+}
+
+// The longest pause that lands in the bucket
+static uint64_t bucketLimit(int bucket) {
+    if (bucket < (1 << GC_PAUSE_SUB_BITS)) return (uint64_t)bucket;
+    int shift = (bucket >> GC_PAUSE_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)((1 << GC_PAUSE_SUB_BITS) + (bucket & ((1 << GC_PAUSE_SUB_BITS) - 1))) << shift;
+    return low + ((uint64_t)1 << shift) - 1;
+}
+
+static void addTimes(GCPhaseTimes* total, const GCPhaseTimes* times) {
+    total->mark += times->mark;
+    total->strings += times->strings;
+    total->sweep += times->sweep;
+    total->compact += times->compact;
+    total->pause += times->pause;
+}
+
+void recordCollection(GCStats* stats, const GCPhaseTimes* times, size_t freed, size_t live, bool compacted) {
+    stats->collections++;
+    if (compacted) stats->compactions++;
+    addTimes(&stats->total, times);
+    stats->last = *times;
+    if (times->pause > stats->maxPause) stats->maxPause = times->pause;
+    stats->bytesFreed += freed;
+    stats->lastFreed = freed;
+    stats->liveHeap = live;
+    if (live > stats->peakLiveHeap) stats->peakLiveHeap = live;
+    stats->pauses[pauseBucket(times->pause)]++;
+}
+
+uint64_t gcPausePercentile(const GCStats* stats, double percentile) {
+    if (stats->collections == 0) return 0;
+    // The rank of the pause we're after, counting from 1
+    uint64_t rank = (uint64_t)(percentile * stats->collections + 0.999999);
+    if (rank < 1) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < GC_PAUSE_BUCKETS; i++) {
+        seen += stats->pauses[i];
+        if (seen >= rank) {
+            uint64_t limit = bucketLimit(i);
+            return limit < stats->maxPause ? limit : stats->maxPause;
+        }
+    }
+    return stats->maxPause;
+}
+
+static double milliseconds(uint64_t nanoseconds) {
+    return nanoseconds / 1e6;
+}
+
+static double megabytes(size_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+void printGCStats(const GCStats* stats, FILE* out) {
+    uint64_t runTime = gcClock() - stats->startTime;
+    const GCPhaseTimes* total = &stats->total;
+    fprintf(out, "GC stats:\n");
+    fprintf(out, "  collections      %llu (%llu compacting)\n",
+            (unsigned long long)stats->collections, (unsigned long long)stats->compactions);
+    fprintf(out, "  total pause      %.3f ms, %.1f%% of %.3f ms run time\n", milliseconds(total->pause),
+            runTime > 0 ? 100.0 * total->pause / runTime : 0.0, milliseconds(runTime));
+    fprintf(out, "  pause p50        %.3f ms\n", milliseconds(gcPausePercentile(stats, 0.5)));
+    fprintf(out, "  pause p90        %.3f ms\n", milliseconds(gcPausePercentile(stats, 0.9)));
+    fprintf(out, "  pause p99        %.3f ms\n", milliseconds(gcPausePercentile(stats, 0.99)));
+    fprintf(out, "  pause max        %.3f ms\n", milliseconds(stats->maxPause));
+    fprintf(out, "  mark             %.3f ms\n", milliseconds(total->mark));
+    fprintf(out, "  string table     %.3f ms\n", milliseconds(total->strings));
+    fprintf(out, "  sweep            %.3f ms\n", milliseconds(total->sweep));
+    fprintf(out, "  compaction       %.3f ms\n", milliseconds(total->compact));
+    fprintf(out, "  freed            %.2f MB\n", megabytes(stats->bytesFreed));
+    fprintf(out, "  live after last  %.2f MB (peak %.2f MB)\n",
+            megabytes(stats->liveHeap), megabytes(stats->peakLiveHeap));
+}
@@ -0,0 +1,64 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * Statistics the GC keeps on itself: how many collections there were, where their time went, how much they freed
+ * and what survived. Collecting them costs a few clock reads per collection, so they are always on.
+ *
+ * Pause times also go into a histogram, so percentiles can be read back without keeping every pause. Its buckets
+ * double in width every eight buckets, which keeps any percentile within 12.5% of the real pause.
+ */
+#ifndef clox_gcstats_h
+#define clox_gcstats_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+// Eight buckets per doubling, up to pauses of 2^40 ns (about 18 minutes)
+#define GC_PAUSE_SUB_BITS 3
+#define GC_PAUSE_MAX_BITS 40
+#define GC_PAUSE_BUCKETS ((GC_PAUSE_MAX_BITS - GC_PAUSE_SUB_BITS + 1) << GC_PAUSE_SUB_BITS)
+
+// Time spent in each phase of a collection, in nanoseconds
+typedef struct {
+    // Tracing from the roots, including ephemerons and clearing weak references
+    uint64_t mark;
+    // Dropping dead strings from the intern table and shrinking it
+    uint64_t strings;
+    // Freeing dead objects and handing empty regions back
+    uint64_t sweep;
+    // Moving objects out of sparse regions and fixing up references, for compacting collections only
+    uint64_t compact;
+    // The whole collection, start to finish
+    uint64_t pause;
+} GCPhaseTimes;
+
+typedef struct {
+    uint64_t collections;
+    // How many of the collections also compacted the heap
+    uint64_t compactions;
+    GCPhaseTimes total;
+    GCPhaseTimes last;
+    uint64_t maxPause;
+    size_t bytesFreed;
+    size_t lastFreed;
+    // What was left allocated after the last collection, and the most that was ever left after one
+    size_t liveHeap;
+    size_t peakLiveHeap;
+    // When the VM started, to tell what share of the run the GC took
+    uint64_t startTime;
+    uint32_t pauses[GC_PAUSE_BUCKETS];
+} GCStats;
+
+void initGCStats(GCStats* stats);
+// A monotonic clock in nanoseconds, for timing the phases
+uint64_t gcClock();
+void recordCollection(GCStats* stats, const GCPhaseTimes* times, size_t freed, size_t live, bool compacted);
+// The pause that 'percentile' (0 to 1) of collections took no longer than, in nanoseconds
+uint64_t gcPausePercentile(const GCStats* stats, double percentile);
+// Writes a human readable summary, as printed by --gc-stats
+void printGCStats(const GCStats* stats, FILE* out);
+
+#endif
@@ -0,0 +1,53 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * Handles keep the values C code is holding on to alive across allocations, without pushing them on the VM stack.
+ * Open a scope, make a handle for each temporary, and close the scope once they are no longer needed:
+ *
+ *     HandleScope scope = openHandleScope();
+ *     Handle name = newHandle(OBJ_VAL(copyString(chars, length)));
+ *     Handle native = newHandle(OBJ_VAL(newNative(function)));
+ *     tableSet(&vm.globals, AS_STRING(*name), *native);
+ *     closeHandleScope(scope);
+ *
+ * The GC marks whatever the handles hold, and points them at the new home of anything it moves. Read through the
+ * handle again after anything that may allocate, instead of keeping a copy of the value around.
+ * Scopes nest, as long as they are closed in the opposite order they were opened.
+ */
+#ifndef clox_handles_h
+#define clox_handles_h
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "vm.h"
+
+typedef Value* Handle;
+
+typedef struct {
+    // How many handles were open before the scope
+    int base;
+} HandleScope;
+
+static inline HandleScope openHandleScope() {
+    return (HandleScope){vm.handleCount};
+}
+
+static inline Handle newHandle(Value value) {
+    if (vm.handleCount == HANDLES_MAX) {
+        fprintf(stderr, "More than %d handles open at once\n", HANDLES_MAX);
+        exit(1);
+    }
+    Handle handle = &vm.handles[vm.handleCount++];
+    *handle = value;
+    return handle;
+}
+
+// Drops every handle made since the scope was opened
+static inline void closeHandleScope(HandleScope scope) {
+    vm.handleCount = scope.base;
+}
+
+#endif
@@ -0,0 +1,586 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+#include "heap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Arenas are mapped straight from the OS where we can, so that pages can be handed back to it too
+#if defined(__unix__) || defined(__APPLE__)
+#define HEAP_USE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define GRANULES(size) (((size) + HEAP_GRANULE - 1) / HEAP_GRANULE)
+#define ARENA_SIZE (HEAP_REGIONS_PER_ARENA * HEAP_REGION_SIZE)
+// The header's own granules are never handed out, so cells start at the first granule past it
+#define HEADER_SIZE (GRANULES(sizeof(HeapRegion)) * HEAP_GRANULE)
+#define FIRST_CELL(region) ((uint8_t*)(region) + HEADER_SIZE)
+
+#ifdef HEAP_COMPRESSED_REFS
+#ifndef HEAP_USE_MMAP
+#error "HEAP_COMPRESSED_REFS needs mmap to reserve the heap's address space"
+#endif
+uint8_t* heapBase = NULL;
+#endif
+
+#ifdef HEAP_USE_MMAP
+// Where the pages a released region gives back start. The header, mark and alloc bitmaps included, spans the first
+// few pages, and stays resident because it is what keeps the region on its list.
+static size_t releasedOffset() {
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    return (sizeof(HeapRegion) + pageSize - 1) & ~(pageSize - 1);
+}
+#endif
+
+static void initSpace(HeapSpace* space) {
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        space->currentRegions[i] = NULL;
+        space->partialRegions[i] = NULL;
+    }
+}
+
+void initHeap(Heap* heap) {
+    heap->regions = NULL;
+    heap->emptyRegions = NULL;
+    heap->residentEmptyCount = 0;
+    heap->largeRegions = NULL;
+    heap->freeSpans = NULL;
+    initSpace(&heap->objects);
+    initSpace(&heap->blocks);
+    heap->arenaTop = NULL;
+    heap->arenaEnd = NULL;
+    heap->arenas = NULL;
+    heap->arenaCount = 0;
+    heap->arenaCapacity = 0;
+}
+
+void freeHeap(Heap* heap) {
+#ifdef HEAP_COMPRESSED_REFS
+    // Every region, large or not, is part of the one reservation
+    if (heapBase != NULL) munmap(heapBase, HEAP_RESERVATION);
+    heapBase = NULL;
+#else
+    HeapRegion* large = heap->largeRegions;
+    while (large != NULL) {
+        // Single region ones belong to an arena
+        HeapRegion* next = large->next;
+        if (large->end - (uint8_t*)large != HEAP_REGION_SIZE) free(large);
+        large = next;
+    }
+    for (int i = 0; i < heap->arenaCount; i++) {
+#ifdef HEAP_USE_MMAP
+        munmap(heap->arenas[i], ARENA_SIZE);
+#else
+        free(heap->arenas[i]);
+#endif
+    }
+    free(heap->arenas);
+#endif
+    initHeap(heap);
+}
+
+static int sizeClassOf(size_t size) {
+    size_t granules = GRANULES(size);
+    if (granules <= 8) return (int)granules - 1;
+    if (granules <= 32) return 8 + (int)(granules - 9) / 2;
+    // Past 512 bytes there are four classes for every power of two, so a cell wastes at most a fifth of itself
+    int power = 63 - __builtin_clzll(size - 1);
+    return 20 + (power - 9) * 4 + (int)((size - 1) >> (power - 2)) - 4;
+}
+
+static size_t cellSizeOf(int sizeClass) {
+    if (sizeClass < 8) return (sizeClass + 1) * HEAP_GRANULE;
+    if (sizeClass < 20) return 128 + (sizeClass - 7) * 2 * HEAP_GRANULE;
+    int power = 9 + (sizeClass - 20) / 4;
+    return ((size_t)1 << power) + ((sizeClass - 20) % 4 + 1) * ((size_t)1 << (power - 2));
+}
+
+#ifdef HEAP_COMPRESSED_REFS
+// The whole reservation is one big arena, whose pages only get used as regions are carved out of it
+static void newArena(Heap* heap) {
+    // Running out of it is as fatal as running out of memory
+    if (heapBase != NULL) exit(1);
+    // Aligned to an arena, for the same reasons as below
+    size_t mappedSize = HEAP_RESERVATION + ARENA_SIZE;
+    uint8_t* mapped = (uint8_t*)mmap(NULL, mappedSize, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapped == MAP_FAILED) exit(1);
+    heapBase = (uint8_t*)(((uintptr_t)mapped + ARENA_SIZE - 1) & ~(uintptr_t)(ARENA_SIZE - 1));
+    if (heapBase > mapped) munmap(mapped, heapBase - mapped);
+    if (heapBase + HEAP_RESERVATION < mapped + mappedSize) {
+        munmap(heapBase + HEAP_RESERVATION, mapped + mappedSize - (heapBase + HEAP_RESERVATION));
+    }
+#if defined(HEAP_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+    size_t smallHeap = HEAP_HUGE_PAGE_MIN_ARENAS * ARENA_SIZE;
+    madvise(heapBase + smallHeap, HEAP_RESERVATION - smallHeap, MADV_HUGEPAGE);
+#endif
+    heap->arenaTop = heapBase;
+    heap->arenaEnd = heapBase + HEAP_RESERVATION;
+}
+#else
+static void newArena(Heap* heap) {
+    // The heap's own bookkeeping uses the system allocator directly, just like the gray stack
+    if (heap->arenaCapacity < heap->arenaCount + 1) {
+        heap->arenaCapacity = heap->arenaCapacity < 8 ? 8 : heap->arenaCapacity * 2;
+        heap->arenas = (void**)realloc(heap->arenas, sizeof(void*) * heap->arenaCapacity);
+        if (heap->arenas == NULL) exit(1);
+    }
+
+    // The alignment is what makes heapRegionOf() work
+#ifdef HEAP_USE_MMAP
+    // mmap only lines memory up with a page, so map twice as much and trim an arena aligned to its own size out of
+    // it. That also lines every arena up with huge pages.
+    size_t mappedSize = 2 * ARENA_SIZE;
+    uint8_t* mapped = (uint8_t*)mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) exit(1);
+    uint8_t* arena = (uint8_t*)(((uintptr_t)mapped + ARENA_SIZE - 1) & ~(uintptr_t)(ARENA_SIZE - 1));
+    if (arena > mapped) munmap(mapped, arena - mapped);
+    if (arena + ARENA_SIZE < mapped + mappedSize) {
+        munmap(arena + ARENA_SIZE, mapped + mappedSize - (arena + ARENA_SIZE));
+    }
+#if defined(HEAP_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+    if (heap->arenaCount >= HEAP_HUGE_PAGE_MIN_ARENAS) madvise(arena, ARENA_SIZE, MADV_HUGEPAGE);
+#endif
+#else
+    uint8_t* arena = (uint8_t*)aligned_alloc(HEAP_REGION_SIZE, ARENA_SIZE);
+    if (arena == NULL) exit(1);
+#endif
+    heap->arenas[heap->arenaCount++] = arena;
+    heap->arenaTop = arena;
+    heap->arenaEnd = arena + ARENA_SIZE;
+}
+#endif
+
+static void pushEmpty(Heap* heap, HeapRegion* region) {
+    region->released = false;
+    region->idle = false;
+    region->next = heap->emptyRegions;
+    heap->emptyRegions = region;
+    heap->residentEmptyCount++;
+}
+
+static HeapRegion* takeRegion(Heap* heap) {
+    HeapRegion* region = heap->emptyRegions;
+    if (region != NULL) {
+        heap->emptyRegions = region->next;
+        if (!region->released) heap->residentEmptyCount--;
+    } else {
+        if (heap->arenaTop == heap->arenaEnd) newArena(heap);
+        region = (HeapRegion*)heap->arenaTop;
+        heap->arenaTop += HEAP_REGION_SIZE;
+    }
+    return region;
+}
+
+static HeapRegion* newRegion(Heap* heap, HeapSpace* space, int sizeClass) {
+    HeapRegion* region = takeRegion(heap);
+    region->cellSize = cellSizeOf(sizeClass);
+    region->sizeClass = sizeClass;
+    region->holdsObjects = space == &heap->objects;
+    region->evacuating = false;
+    region->top = FIRST_CELL(region);
+    region->end = (uint8_t*)region + HEAP_REGION_SIZE;
+    region->freeList = NULL;
+    region->liveCells = 0;
+    region->partial = false;
+    memset(region->markBits, 0, sizeof(region->markBits));
+    memset(region->allocBits, 0, sizeof(region->allocBits));
+    region->next = heap->regions;
+    heap->regions = region;
+    space->currentRegions[sizeClass] = region;
+    return region;
+}
+
+static void linkPartial(HeapSpace* space, HeapRegion* region) {
+    HeapRegion** head = &space->partialRegions[region->sizeClass];
+    region->partial = true;
+    region->prevPartial = NULL;
+    region->nextPartial = *head;
+    if (*head != NULL) (*head)->prevPartial = region;
+    *head = region;
+}
+
+static void unlinkPartial(HeapSpace* space, HeapRegion* region) {
+    if (!region->partial) return;
+    region->partial = false;
+    if (region->prevPartial != NULL) {
+        region->prevPartial->nextPartial = region->nextPartial;
+    } else {
+        space->partialRegions[region->sizeClass] = region->nextPartial;
+    }
+    if (region->nextPartial != NULL) region->nextPartial->prevPartial = region->prevPartial;
+}
+
+static void* allocateCell(Heap* heap, HeapSpace* space, size_t size) {
+    if (size > HEAP_MAX_CELL_SIZE) exit(1);
+    int sizeClass = sizeClassOf(size);
+
+    // Holes left by freed cells get filled in before any fresh cells are carved out, so that the objects of a size
+    // class stay packed into as few regions as they can
+    HeapRegion* region = space->currentRegions[sizeClass];
+    if (region == NULL || region->freeList == NULL) {
+        HeapRegion* partial = space->partialRegions[sizeClass];
+        if (partial != NULL) {
+            // Whatever is left to carve out of the current region waits until it has a hole of its own again
+            unlinkPartial(space, partial);
+            space->currentRegions[sizeClass] = partial;
+            region = partial;
+        } else if (region == NULL || region->top + region->cellSize > region->end) {
+            region = newRegion(heap, space, sizeClass);
+        }
+    }
+
+    void* cell = region->freeList;
+    if (cell != NULL) {
+        region->freeList = *(void**)cell;
+        return cell;
+    }
+    cell = region->top;
+    region->top += region->cellSize;
+    return cell;
+}
+
+// Free cells stay with their region, so that a region that empties out can be given up without hunting them down
+static void freeCell(HeapSpace* space, void* pointer) {
+    HeapRegion* region = heapRegionOf(pointer);
+    *(void**)pointer = region->freeList;
+    region->freeList = pointer;
+    if (!region->partial && space->currentRegions[region->sizeClass] != region) linkPartial(space, region);
+}
+
+static void setAllocated(void* pointer, bool allocated) {
+    size_t granule = heapGranuleOf(pointer);
+    uint64_t bit = (uint64_t)1 << (granule % 64);
+    uint64_t* word = &heapRegionOf(pointer)->allocBits[granule / 64];
+    *word = allocated ? *word | bit : *word & ~bit;
+}
+
+static size_t largeRegionSize(size_t size) {
+    return (HEADER_SIZE + size + HEAP_REGION_SIZE - 1) / HEAP_REGION_SIZE * HEAP_REGION_SIZE;
+}
+
+#ifdef HEAP_COMPRESSED_REFS
+// Objects bigger than a region can't come from malloc, as they have to be inside the reservation too. They get a
+// span of regions from it instead, reusing the first freed span that's big enough.
+static HeapRegion* takeSpan(Heap* heap, size_t size) {
+    for (HeapRegion** link = &heap->freeSpans; *link != NULL; link = &(*link)->next) {
+        HeapRegion* span = *link;
+        size_t spanSize = span->end - (uint8_t*)span;
+        if (spanSize < size) continue;
+        if (spanSize == size) {
+            *link = span->next;
+        } else {
+            // What's left over stays on the list
+            HeapRegion* rest = (HeapRegion*)((uint8_t*)span + size);
+            rest->end = span->end;
+            rest->next = span->next;
+            *link = rest;
+        }
+        return span;
+    }
+
+    if (heap->arenaTop == NULL) newArena(heap);
+    if ((size_t)(heap->arenaEnd - heap->arenaTop) < size) exit(1);
+    HeapRegion* span = (HeapRegion*)heap->arenaTop;
+    heap->arenaTop += size;
+    return span;
+}
+
+static void freeSpan(Heap* heap, HeapRegion* span) {
+    // Gives back all but the header's pages, like heapReleaseEmpty()
+    size_t offset = releasedOffset();
+    madvise((uint8_t*)span + offset, span->end - (uint8_t*)span - offset, MADV_DONTNEED);
+    span->next = heap->freeSpans;
+    heap->freeSpans = span;
+}
+#endif
+
+static void* allocateLarge(Heap* heap, size_t size) {
+    // Anything that fits in one region recycles regions like every other size does, only bigger ones need their own
+    size_t regionSize = largeRegionSize(size);
+    HeapRegion* region;
+    if (regionSize == HEAP_REGION_SIZE) {
+        region = takeRegion(heap);
+    } else {
+#ifdef HEAP_COMPRESSED_REFS
+        region = takeSpan(heap, regionSize);
+#else
+        region = (HeapRegion*)aligned_alloc(HEAP_REGION_SIZE, regionSize);
+        if (region == NULL) exit(1);
+#endif
+    }
+
+    region->cellSize = size;
+    region->sizeClass = -1;
+    region->holdsObjects = true;
+    region->evacuating = false;
+    region->top = FIRST_CELL(region) + size;
+    region->end = (uint8_t*)region + regionSize;
+    memset(region->markBits, 0, sizeof(region->markBits));
+    memset(region->allocBits, 0, sizeof(region->allocBits));
+    region->prev = NULL;
+    region->next = heap->largeRegions;
+    if (heap->largeRegions != NULL) heap->largeRegions->prev = region;
+    heap->largeRegions = region;
+    return FIRST_CELL(region);
+}
+
+static void freeLarge(Heap* heap, HeapRegion* region) {
+    if (region->prev != NULL) {
+        region->prev->next = region->next;
+    } else {
+        heap->largeRegions = region->next;
+    }
+    if (region->next != NULL) region->next->prev = region->prev;
+
+    if (region->end - (uint8_t*)region == HEAP_REGION_SIZE) {
+        pushEmpty(heap, region);
+    } else {
+#ifdef HEAP_COMPRESSED_REFS
+        freeSpan(heap, region);
+#else
+        free(region);
+#endif
+    }
+}
+
+void* heapAllocateObject(Heap* heap, size_t size) {
+    void* object = size > HEAP_MAX_CELL_SIZE ? allocateLarge(heap, size) : allocateCell(heap, &heap->objects, size);
+    setAllocated(object, true);
+    return object;
+}
+
+void heapFreeObject(Heap* heap, void* pointer, size_t size) {
+    if (size > HEAP_MAX_CELL_SIZE) {
+        freeLarge(heap, heapRegionOf(pointer));
+        return;
+    }
+    setAllocated(pointer, false);
+    freeCell(&heap->objects, pointer);
+}
+
+size_t heapLargeFootprint(size_t size, bool isObject) {
+    if (size <= HEAP_MAX_CELL_SIZE) return cellSizeOf(sizeClassOf(size));
+    // A big object gets whole regions to itself, any other big block is left to malloc
+    return isObject ? largeRegionSize(size) : size;
+}
+
+void* heapReallocate(Heap* heap, void* pointer, size_t oldSize, size_t newSize) {
+    bool wasSmall = oldSize <= HEAP_MAX_CELL_SIZE;
+    bool isSmall = newSize <= HEAP_MAX_CELL_SIZE;
+
+    if (newSize == 0) {
+        if (pointer == NULL) return NULL;
+        if (wasSmall) {
+            freeCell(&heap->blocks, pointer);
+        } else {
+            free(pointer);
+        }
+        return NULL;
+    }
+
+    if (!wasSmall && !isSmall) {
+        void* result = realloc(pointer, newSize);
+        if (result == NULL) exit(1);
+        return result;
+    }
+
+    // Resizing within a size class is free
+    if (pointer != NULL && wasSmall && isSmall && sizeClassOf(oldSize) == sizeClassOf(newSize)) {
+        return pointer;
+    }
+
+    void* result = isSmall ? allocateCell(heap, &heap->blocks, newSize) : malloc(newSize);
+    if (result == NULL) exit(1);
+    if (pointer != NULL) {
+        memcpy(result, pointer, oldSize < newSize ? oldSize : newSize);
+        heapReallocate(heap, pointer, oldSize, 0);
+    }
+    return result;
+}
+
+// Bitmap words past the bump pointer are always zero, so scans can stop short of them
+static int usedWords(HeapRegion* region) {
+    return (int)(((region->top - (uint8_t*)region) / HEAP_GRANULE + 63) / 64);
+}
+
+// When sweeping, only unmarked objects get visited, and the marked ones are counted along the way
+static void visitObjects(Heap* heap, HeapVisitor visit, bool sweeping) {
+    for (HeapRegion* region = heap->regions; region != NULL; region = region->next) {
+        if (!region->holdsObjects) continue;
+        size_t live = 0;
+        int words = usedWords(region);
+        for (int i = 0; i < words; i++) {
+            // Works off a copy of the word, so the visitor freeing objects doesn't disturb the walk
+            uint64_t bits = region->allocBits[i];
+            if (sweeping) {
+                uint64_t marks = region->markBits[i];
+                bits &= ~marks;
+                if (marks != 0) live += __builtin_popcountll(marks);
+            }
+            while (bits != 0) {
+                int bit = __builtin_ctzll(bits);
+                bits &= bits - 1;
+                visit((uint8_t*)region + (i * 64 + bit) * HEAP_GRANULE);
+            }
+        }
+        if (sweeping) region->liveCells = live;
+    }
+
+    HeapRegion* large = heap->largeRegions;
+    while (large != NULL) {
+        // Freeing the object frees its region along with it
+        HeapRegion* next = large->next;
+        if (!sweeping || !heapIsMarked(FIRST_CELL(large))) visit(FIRST_CELL(large));
+        large = next;
+    }
+}
+
+void heapEachObject(Heap* heap, HeapVisitor visit) {
+    visitObjects(heap, visit, false);
+}
+
+// Moves object regions without a single object left in them to the empty list, where any size class can reuse them.
+// Block regions don't keep track of what's allocated in them, so they stay with their size class.
+static void recycleEmptyRegions(Heap* heap) {
+    HeapRegion** link = &heap->regions;
+    while (*link != NULL) {
+        HeapRegion* region = *link;
+        if (!region->holdsObjects || region->liveCells > 0) {
+            link = &region->next;
+            continue;
+        }
+
+        HeapRegion** current = &heap->objects.currentRegions[region->sizeClass];
+        if (*current == region) {
+            HeapRegion* partial = heap->objects.partialRegions[region->sizeClass];
+            if (partial == NULL) {
+                // It would only be taken straight back, so it just starts over
+                region->top = FIRST_CELL(region);
+                region->freeList = NULL;
+                link = &region->next;
+                continue;
+            }
+            // Filling in the holes of another region first means fewer regions left pinned down by a few survivors
+            unlinkPartial(&heap->objects, partial);
+            *current = partial;
+        } else {
+            unlinkPartial(&heap->objects, region);
+        }
+        *link = region->next;
+        pushEmpty(heap, region);
+    }
+}
+
+void heapSweep(Heap* heap, HeapVisitor visit) {
+    visitObjects(heap, visit, true);
+    recycleEmptyRegions(heap);
+}
+
+void heapReleaseEmpty(Heap* heap) {
+#ifdef HEAP_USE_MMAP
+    if (heap->residentEmptyCount <= HEAP_RESIDENT_EMPTY_REGIONS) return;
+    size_t offset = releasedOffset();
+    // Regions go on the front of the list as they empty out, so the ones kept are the ones emptied most recently.
+    // Past those, a region is only released once it has sat empty through a whole collection cycle, so that a heap
+    // that shrinks and grows right back doesn't keep faulting the same pages in again.
+    int resident = heap->residentEmptyCount;
+    int seen = 0;
+    for (HeapRegion* region = heap->emptyRegions; seen < resident; region = region->next) {
+        if (region->released) continue;
+        if (++seen <= HEAP_RESIDENT_EMPTY_REGIONS) continue;
+        if (!region->idle) {
+            region->idle = true;
+            continue;
+        }
+        // The OS hands back zeroed pages for the rest the next time they're touched
+        madvise((uint8_t*)region + offset, HEAP_REGION_SIZE - offset, MADV_DONTNEED);
+        region->released = true;
+        heap->residentEmptyCount--;
+    }
+#endif
+}
+
+void heapClearMarks(Heap* heap) {
+    for (HeapRegion* region = heap->regions; region != NULL; region = region->next) {
+        if (region->holdsObjects) memset(region->markBits, 0, usedWords(region) * sizeof(uint64_t));
+    }
+    for (HeapRegion* large = heap->largeRegions; large != NULL; large = large->next) {
+        large->markBits[heapGranuleOf(FIRST_CELL(large)) / 64] = 0;
+    }
+}
+
+static size_t carvedCells(HeapRegion* region) {
+    return (region->top - FIRST_CELL(region)) / region->cellSize;
+}
+
+static bool isSparse(HeapRegion* region) {
+    size_t carved = carvedCells(region);
+    return carved > 0 && region->liveCells < carved * HEAP_EVACUATE_OCCUPANCY;
+}
+
+void heapMeasure(Heap* heap, HeapUsage* usage) {
+    usage->objectBytes = 0;
+    usage->liveBytes = 0;
+    usage->reclaimableBytes = 0;
+    for (HeapRegion* region = heap->regions; region != NULL; region = region->next) {
+        if (!region->holdsObjects) continue;
+        size_t liveBytes = region->liveCells * region->cellSize;
+        usage->objectBytes += HEAP_REGION_SIZE;
+        usage->liveBytes += liveBytes;
+        // Evacuating a sparse region frees all of it, less the room its survivors take up elsewhere
+        if (isSparse(region)) usage->reclaimableBytes += HEAP_REGION_SIZE - liveBytes;
+    }
+}
+
+bool heapEvacuate(Heap* heap) {
+    bool anyEvacuating = false;
+    for (HeapRegion* region = heap->regions; region != NULL; region = region->next) {
+        if (!region->holdsObjects) continue;
+        region->evacuating = isSparse(region);
+        anyEvacuating |= region->evacuating;
+    }
+    if (!anyEvacuating) return false;
+
+    // Evacuating regions don't hand out any more cells
+    for (int i = 0; i < HEAP_SIZE_CLASSES; i++) {
+        HeapRegion* current = heap->objects.currentRegions[i];
+        if (current != NULL && current->evacuating) heap->objects.currentRegions[i] = NULL;
+    }
+    for (HeapRegion* region = heap->regions; region != NULL; region = region->next) {
+        if (region->evacuating) unlinkPartial(&heap->objects, region);
+    }
+
+    for (HeapRegion* region = heap->regions; region != NULL; region = region->next) {
+        if (!region->evacuating) continue;
+        for (uint8_t* cell = FIRST_CELL(region); cell < region->top; cell += region->cellSize) {
+            if (!heapIsMarked(cell)) continue;
+            // New regions go on the front of the list, so this never revisits them
+            void* copy = heapAllocateObject(heap, region->cellSize);
+            memcpy(copy, cell, region->cellSize);
+            heapSetMarked(copy);
+            *(void**)cell = copy;
+        }
+        // Only forwarding addresses are left behind, which nothing should visit as objects
+        memset(region->allocBits, 0, sizeof(region->allocBits));
+    }
+    return true;
+}
+
+void heapReleaseEvacuated(Heap* heap) {
+    HeapRegion** link = &heap->regions;
+    while (*link != NULL) {
+        HeapRegion* region = *link;
+        if (region->evacuating) {
+            *link = region->next;
+            region->evacuating = false;
+            pushEmpty(heap, region);
+        } else {
+            link = &region->next;
+        }
+    }
+}
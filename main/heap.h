@@ -0,0 +1,205 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * The heap behind reallocate(). Small blocks, including every Obj, are carved out of fixed size regions that are
+ * aligned to their own size, so the region owning any block can be found by masking its address. That lets the GC
+ * keep its mark bits off to the side in a dense per-region bitmap, instead of writing a flag into every live object.
+ *
+ * Each region serves a single size class of a single space, and regions are in turn carved out of much larger
+ * arenas. Objects get their own space, so that object regions hold nothing but objects and can be compacted. Object
+ * regions also keep a bitmap of which cells are allocated, which is how the GC finds every object without needing
+ * a list running through them.
+ * Any other block bigger than the largest size class goes straight to malloc, while such a big object gets an
+ * aligned region all to itself.
+ *
+ * Object regions left without a single object by a sweep go back on the empty list, and once a collection is done
+ * all but a few of the empty regions have their pages handed back to the OS.
+ *
+ * With HEAP_COMPRESSED_REFS, the heap reserves all of its address space up front instead, and big objects are carved
+ * out of it too, so that every object can be referred to by its offset into the reservation.
+ */
+#ifndef clox_heap_h
+#define clox_heap_h
+
+#include "common.h"
+
+#define HEAP_REGION_SIZE (256 * 1024)
+#define HEAP_REGIONS_PER_ARENA 16
+// Blocks always start on a granule boundary, and each granule gets exactly one mark bit.
+#define HEAP_GRANULE 16
+#define HEAP_GRANULE_COUNT (HEAP_REGION_SIZE / HEAP_GRANULE)
+// Size classes step by one granule up to 128 bytes, by two granules up to 512, then by a quarter of each doubling
+#define HEAP_SIZE_CLASSES 36
+#define HEAP_MAX_CELL_SIZE 8192
+// Object regions with fewer live cells than this get evacuated when the heap is compacted
+#define HEAP_EVACUATE_OCCUPANCY 0.5
+// Empty regions kept ready for reuse, instead of going back to the OS, so a steady churn doesn't keep faulting in pages
+#define HEAP_RESIDENT_EMPTY_REGIONS 8
+// With HEAP_HUGE_PAGES, arenas past this many are backed by transparent huge pages
+#define HEAP_HUGE_PAGE_MIN_ARENAS 4
+// With HEAP_COMPRESSED_REFS, the address space reserved up front for the whole heap. Offsets into it fit in 32 bits.
+#define HEAP_RESERVATION ((size_t)4 * 1024 * 1024 * 1024)
+
+typedef struct HeapRegion {
+    struct HeapRegion* next;
+    // Only used by large object regions, so that freeing one doesn't have to search the list
+    struct HeapRegion* prev;
+    size_t cellSize;
+    int sizeClass;
+    bool holdsObjects;
+    // Set while a compaction is moving everything out of this region
+    bool evacuating;
+    // Set once an empty region's pages, all but the header's, have been given back to the OS
+    bool released;
+    // Set on an empty region that has been through a release pass, which will release it the next time around
+    bool idle;
+    // Fresh cells are bump allocated out of [top, end)
+    uint8_t* top;
+    uint8_t* end;
+    // Cells freed since, threaded through their first word
+    void* freeList;
+    // How many cells the last sweep found marked
+    size_t liveCells;
+    // Links the regions of a size class with freed cells to hand out, other than the one being allocated from
+    struct HeapRegion* nextPartial;
+    struct HeapRegion* prevPartial;
+    bool partial;
+    uint64_t markBits[HEAP_GRANULE_COUNT / 64];
+    // Only kept up to date in object regions, one bit on the first granule of every allocated cell
+    uint64_t allocBits[HEAP_GRANULE_COUNT / 64];
+} HeapRegion;
+
+typedef struct {
+    // The region each size class is currently allocating out of, first from its free list and then by bumping
+    HeapRegion* currentRegions[HEAP_SIZE_CLASSES];
+    // The size class's other regions that have freed cells, which it moves on to once the current one runs out
+    HeapRegion* partialRegions[HEAP_SIZE_CLASSES];
+} HeapSpace;
+
+typedef struct {
+    // Total size of the object regions
+    size_t objectBytes;
+    // How much of that is taken up by marked cells
+    size_t liveBytes;
+    // How much evacuating every sparse object region would give back
+    size_t reclaimableBytes;
+} HeapUsage;
+
+typedef struct {
+    HeapRegion* regions;
+    // Regions emptied by sweeping or compaction, ready to be handed to any size class again
+    HeapRegion* emptyRegions;
+    // How many of those still have their pages
+    int residentEmptyCount;
+    // Each holding a single object too big for any size class. These are never moved.
+    HeapRegion* largeRegions;
+    // With HEAP_COMPRESSED_REFS, the freed regions of objects that took up more than one. Their header's end says
+    // how big they are.
+    HeapRegion* freeSpans;
+    HeapSpace objects;
+    HeapSpace blocks;
+    // Regions not yet handed to a size class, in [arenaTop, arenaEnd)
+    uint8_t* arenaTop;
+    uint8_t* arenaEnd;
+    void** arenas;
+    int arenaCount;
+    int arenaCapacity;
+} Heap;
+
+typedef void (*HeapVisitor)(void* object);
+
+void initHeap(Heap* heap);
+// Releases every arena back to the system. Any objects still inside them are simply dropped.
+void freeHeap(Heap* heap);
+// Allocates the memory for an Obj of any size
+void* heapAllocateObject(Heap* heap, size_t size);
+void heapFreeObject(Heap* heap, void* pointer, size_t size);
+// Same four cases as reallocate(), without any of the GC bookkeeping
+void* heapReallocate(Heap* heap, void* pointer, size_t oldSize, size_t newSize);
+// heapFootprint() for sizes past the first few size classes
+size_t heapLargeFootprint(size_t size, bool isObject);
+// Calls visit on every object in the heap. The visitor is free to free the object it is handed.
+void heapEachObject(Heap* heap, HeapVisitor visit);
+// Calls visit on every object left unmarked by the last trace, which is expected to free it
+void heapSweep(Heap* heap, HeapVisitor visit);
+// Wipes every mark bit in the heap; run once a collection has finished with them.
+void heapClearMarks(Heap* heap);
+// Gives the memory of every empty region beyond the first few back to the OS
+void heapReleaseEmpty(Heap* heap);
+
+/*
+ * Compaction support. These all rely on the mark bits and live cell counts of a finished mark and sweep,
+ * at which point every marked cell in an object region is a live object and every unmarked one is free.
+ */
+// How much of the object heap is live, and how much a compaction would give back
+void heapMeasure(Heap* heap, HeapUsage* usage);
+// Moves every live object out of the sparsest object regions, leaving a forwarding address behind in each old
+// cell (see heapForward()). Returns false if there was nothing worth moving.
+bool heapEvacuate(Heap* heap);
+// Once every reference has been forwarded, recycles the evacuated regions
+void heapReleaseEvacuated(Heap* heap);
+
+static inline HeapRegion* heapRegionOf(const void* pointer) {
+    return (HeapRegion*)((uintptr_t)pointer & ~(uintptr_t)(HEAP_REGION_SIZE - 1));
+}
+
+static inline size_t heapGranuleOf(const void* pointer) {
+    return ((uintptr_t)pointer & (HEAP_REGION_SIZE - 1)) / HEAP_GRANULE;
+}
+
+static inline bool heapIsMarked(const void* pointer) {
+    size_t granule = heapGranuleOf(pointer);
+    return (heapRegionOf(pointer)->markBits[granule / 64] >> (granule % 64)) & 1;
+}
+
+static inline void heapSetMarked(const void* pointer) {
+    size_t granule = heapGranuleOf(pointer);
+    heapRegionOf(pointer)->markBits[granule / 64] |= (uint64_t)1 << (granule % 64);
+}
+
+// Starts loading the word holding pointer's mark bit, for a heapIsMarked() on it a little later
+static inline void heapPrefetchMark(const void* pointer) {
+    size_t granule = heapGranuleOf(pointer);
+    __builtin_prefetch(&heapRegionOf(pointer)->markBits[granule / 64], 1);
+}
+
+// How much memory asking for 'size' bytes really takes up, once rounded up to a size class or to whole regions
+static inline size_t heapFootprint(size_t size, bool isObject) {
+    // Up to 128 bytes, which covers most allocations, size classes step by a single granule
+    if (size <= 8 * HEAP_GRANULE) return (size + HEAP_GRANULE - 1) & ~(size_t)(HEAP_GRANULE - 1);
+    return heapLargeFootprint(size, isObject);
+}
+
+/*
+ * Object fields referring to other objects are declared as HEAP_REF(type), and are read with heapUnpack() and
+ * written with heapPack(). With HEAP_COMPRESSED_REFS those are 32 bit offsets from the start of the heap's
+ * reservation, otherwise they are plain pointers. Offset 0 holds the first region's header, so no object is ever
+ * there, and it stands in for NULL.
+ */
+#ifdef HEAP_COMPRESSED_REFS
+#define HEAP_REF(type) uint32_t
+
+extern uint8_t* heapBase;
+
+static inline void* heapUnpack(uint32_t ref) {
+    return ref == 0 ? NULL : heapBase + ref;
+}
+
+static inline uint32_t heapPack(const void* pointer) {
+    return pointer == NULL ? 0 : (uint32_t)((const uint8_t*)pointer - heapBase);
+}
+#else
+#define HEAP_REF(type) type*
+#define heapUnpack(ref) ((void*)(ref))
+#define heapPack(pointer) (pointer)
+#endif
+
+// Where an object lives now, if a compaction in progress has moved it
+static inline void* heapForward(void* pointer) {
+    if (pointer != NULL && heapRegionOf(pointer)->evacuating) return *(void**)pointer;
+    return pointer;
+}
+
+#endif
@@ -0,0 +1,376 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+#include "heapdump.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heap.h"
+#include "object.h"
+#include "vm.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define HEAPDUMP_USE_SIGNAL
+#include <unistd.h>
+#endif
+
+volatile sig_atomic_t heapDumpRequested = 0;
+
+// An object the walk has reached but not written out yet, along with how it got there
+typedef struct {
+    Obj* object;
+    // NULL for roots
+    Obj* parent;
+    // Describes the root, for roots only
+    char* root;
+} Reached;
+
+typedef struct {
+    FILE* file;
+    Reached* queue;
+    int head;
+    int count;
+    int capacity;
+    // Whether the object being written has any refs yet, to know where the commas go
+    bool firstRef;
+} Dump;
+
+static void enqueue(Dump* dump, Obj* object, Obj* parent, char* root) {
+    if (dump->count == dump->capacity) {
+        dump->capacity = dump->capacity < 64 ? 64 : dump->capacity * 2;
+        dump->queue = realloc(dump->queue, sizeof(Reached) * dump->capacity);
+        if (dump->queue == NULL) exit(1);
+    }
+    dump->queue[dump->count++] = (Reached){object, parent, root};
+}
+
+/*
+ * The walk keeps track of what it has reached with the GC's mark bits, which are all clear outside of a collection,
+ * and clears them again once it is done.
+ */
+static void reach(Dump* dump, Obj* object, Obj* parent, char* root) {
+    if (object == NULL || heapIsMarked(object)) {
+        free(root);
+        return;
+    }
+    heapSetMarked(object);
+    enqueue(dump, object, parent, root);
+}
+
+static char* describeRoot(const char* format, const char* name, int number) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), format, name, number);
+    char* root = strdup(buffer);
+    if (root == NULL) exit(1);
+    return root;
+}
+
+static void reachRoot(Dump* dump, Value value, const char* format, const char* name, int number) {
+    if (!IS_OBJ(value) || heapIsMarked(AS_OBJ(value))) return;
+    reach(dump, AS_OBJ(value), NULL, describeRoot(format, name, number));
+}
+
+static const char* functionName(ObjFunction* function) {
+    ObjString* name = LOAD_REF(ObjString, function->name);
+    return name == NULL ? "script" : name->chars;
+}
+
+// The same roots as markRoots() in memory.c. The compiler's are left out, as nothing is being compiled while a dump
+// can run.
+static void reachRoots(Dump* dump) {
+    for (int i = 0; i < vm.frameCount; i++) {
+        CallFrame* frame = &vm.frames[i];
+        ObjFunction* function = LOAD_REF(ObjFunction, frame->closure->function);
+        const char* name = functionName(function);
+        int line = getLine(&function->chunk, (int)(frame->ip - function->chunk.code - 1));
+        reachRoot(dump, OBJ_VAL(frame->closure), "frame %s:%d", name, line);
+        Value* end = i + 1 < vm.frameCount ? vm.frames[i + 1].slots : vm.stackTop;
+        for (Value* slot = frame->slots; slot < end; slot++) {
+            reachRoot(dump, *slot, "%s slot %d", name, (int)(slot - frame->slots));
+        }
+    }
+    // Anything on the stack below the first frame, such as the script's closure while it is being set up
+    Value* first = vm.frameCount > 0 ? vm.frames[0].slots : vm.stackTop;
+    for (Value* slot = vm.stack; slot < first; slot++) {
+        reachRoot(dump, *slot, "stack %s%d", "", (int)(slot - vm.stack));
+    }
+    for (int i = 0; i < vm.handleCount; i++) {
+        reachRoot(dump, vm.handles[i], "handle %s%d", "", i);
+    }
+    int slotCount;
+    Entry* globals = tableSlots(&vm.globals, &slotCount);
+    for (int i = 0; i < slotCount; i++) {
+        if (globals[i].key == NULL) continue;
+        reachRoot(dump, globals[i].value, "global %s", globals[i].key->chars, 0);
+        reachRoot(dump, OBJ_VAL(globals[i].key), "name of global %s", globals[i].key->chars, 0);
+    }
+    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = LOAD_REF(ObjUpvalue, upvalue->next)) {
+        reachRoot(dump, OBJ_VAL(upvalue), "open upvalue %s%d", "", (int)(upvalue->location - vm.stack));
+    }
+    reachRoot(dump, OBJ_VAL(vm.initString), "init string%s", "", 0);
+}
+
+static void writeString(FILE* file, const char* chars) {
+    fputc('"', file);
+    for (const char* c = chars; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(file, "\\u%04x", *c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void writeId(Dump* dump, Obj* object) {
+    fprintf(dump->file, dump->firstRef ? "%llu" : ",%llu", (unsigned long long)(uintptr_t)object);
+    dump->firstRef = false;
+}
+
+// Writes the reference and makes sure the object it points at gets written too
+static void refer(Dump* dump, Obj* from, Obj* to) {
+    if (to == NULL) return;
+    writeId(dump, to);
+    reach(dump, to, from, NULL);
+}
+
+static void referValue(Dump* dump, Obj* from, Value value) {
+    if (IS_OBJ(value)) refer(dump, from, AS_OBJ(value));
+}
+
+static void referTable(Dump* dump, Obj* from, Table* table) {
+    int slotCount;
+    Entry* entries = tableSlots(table, &slotCount);
+    for (int i = 0; i < slotCount; i++) {
+        if (entries[i].key == NULL) continue;
+        refer(dump, from, (Obj*)entries[i].key);
+        referValue(dump, from, entries[i].value);
+    }
+}
+
+// What blackenObject() in memory.c marks, except that the values of weak maps count too
+static void referFields(Dump* dump, Obj* object) {
+    switch (object->type) {
+        case OBJ_UPVALUE:
+            referValue(dump, object, ((ObjUpvalue*)object)->closed);
+            break;
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)object;
+            refer(dump, object, LOAD_REF(Obj, function->name));
+            for (int i = 0; i < function->chunk.constants.count; i++) {
+                referValue(dump, object, function->chunk.constants.values[i]);
+            }
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)object;
+            refer(dump, object, LOAD_REF(Obj, closure->function));
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                refer(dump, object, LOAD_REF(Obj, closure->upvalues[i]));
+            }
+            break;
+        }
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)object;
+            refer(dump, object, LOAD_REF(Obj, klass->name));
+            referTable(dump, object, &klass->methods);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)object;
+            refer(dump, object, LOAD_REF(Obj, instance->klass));
+            referTable(dump, object, &instance->fields);
+            break;
+        }
+        case OBJ_BOUND_METHOD: {
+            ObjBoundMethod* method = (ObjBoundMethod*)object;
+            referValue(dump, object, method->receiver);
+            refer(dump, object, LOAD_REF(Obj, method->method));
+            break;
+        }
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)object;
+            refer(dump, object, LOAD_REF(Obj, rope->left));
+            refer(dump, object, LOAD_REF(Obj, rope->right));
+            refer(dump, object, LOAD_REF(Obj, rope->flat));
+            break;
+        }
+        case OBJ_WEAK_MAP: {
+            EphemeronTable* table = &((ObjWeakMap*)object)->table;
+            for (int i = 0; i < table->capacity; i++) {
+                if (table->entries[i].key != NULL) referValue(dump, object, table->entries[i].value);
+            }
+            break;
+        }
+        case OBJ_WEAK_REF:
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+            break;
+    }
+}
+
+static void writeWeakRefs(Dump* dump, Obj* object) {
+    if (object->type == OBJ_WEAK_REF) {
+        Value target = ((ObjWeakRef*)object)->target;
+        if (IS_OBJ(target)) writeId(dump, AS_OBJ(target));
+    } else if (object->type == OBJ_WEAK_MAP) {
+        EphemeronTable* table = &((ObjWeakMap*)object)->table;
+        for (int i = 0; i < table->capacity; i++) {
+            if (table->entries[i].key != NULL) writeId(dump, table->entries[i].key);
+        }
+    }
+}
+
+static size_t chunkBytes(Chunk* chunk) {
+    return heapFootprint(chunk->capacity, false)
+           + heapFootprint(sizeof(Value) * chunk->constants.capacity, false)
+           + heapFootprint(sizeof(LineStart) * chunk->lineCapacity, false)
+           + heapFootprint(sizeof(StackMapEntry) * chunk->stackMap.capacity, false)
+           + heapFootprint(chunk->stackMap.slotCapacity, false);
+}
+
+// The object's own cell, plus what it owns and frees along with itself
+static size_t objectBytes(Obj* object) {
+    switch (object->type) {
+        case OBJ_STRING: return heapFootprint(SIZEOF_STRING(((ObjString*)object)->length), true);
+        case OBJ_FUNCTION:
+            return heapFootprint(sizeof(ObjFunction), true) + chunkBytes(&((ObjFunction*)object)->chunk);
+        case OBJ_INSTANCE:
+            return heapFootprint(sizeof(ObjInstance), true)
+                   + heapFootprint(tableAllocatedBytes(&((ObjInstance*)object)->fields), false);
+        case OBJ_NATIVE: return heapFootprint(sizeof(ObjNative), true);
+        case OBJ_CLOSURE: return heapFootprint(SIZEOF_CLOSURE(((ObjClosure*)object)->upvalueCount), true);
+        case OBJ_UPVALUE: return heapFootprint(sizeof(ObjUpvalue), true);
+        case OBJ_CLASS:
+            return heapFootprint(sizeof(ObjClass), true)
+                   + heapFootprint(tableAllocatedBytes(&((ObjClass*)object)->methods), false);
+        case OBJ_BOUND_METHOD: return heapFootprint(sizeof(ObjBoundMethod), true);
+        case OBJ_ROPE: return heapFootprint(sizeof(ObjRope), true);
+        case OBJ_WEAK_REF: return heapFootprint(sizeof(ObjWeakRef), true);
+        case OBJ_WEAK_MAP:
+            return heapFootprint(sizeof(ObjWeakMap), true)
+                   + heapFootprint(sizeof(EphemeronEntry) * ((ObjWeakMap*)object)->table.capacity, false);
+    }
+    return 0;
+}
+
+static const char* typeName(ObjType type) {
+    switch (type) {
+        case OBJ_STRING: return "string";
+        case OBJ_FUNCTION: return "function";
+        case OBJ_INSTANCE: return "instance";
+        case OBJ_NATIVE: return "native";
+        case OBJ_CLOSURE: return "closure";
+        case OBJ_UPVALUE: return "upvalue";
+        case OBJ_CLASS: return "class";
+        case OBJ_BOUND_METHOD: return "bound method";
+        case OBJ_ROPE: return "rope";
+        case OBJ_WEAK_REF: return "weak ref";
+        case OBJ_WEAK_MAP: return "weak map";
+    }
+    return "unknown";
+}
+
+// The class of an instance, or the name of anything else that has one
+static void writeName(FILE* file, Obj* object) {
+    const char* key = "name";
+    ObjString* name = NULL;
+    switch (object->type) {
+        case OBJ_INSTANCE:
+            key = "class";
+            name = LOAD_REF(ObjString, LOAD_REF(ObjClass, ((ObjInstance*)object)->klass)->name);
+            break;
+        case OBJ_CLASS: name = LOAD_REF(ObjString, ((ObjClass*)object)->name); break;
+        case OBJ_FUNCTION: name = LOAD_REF(ObjString, ((ObjFunction*)object)->name); break;
+        case OBJ_CLOSURE:
+            name = LOAD_REF(ObjString, LOAD_REF(ObjFunction, ((ObjClosure*)object)->function)->name);
+            break;
+        case OBJ_BOUND_METHOD: {
+            ObjClosure* method = LOAD_REF(ObjClosure, ((ObjBoundMethod*)object)->method);
+            name = LOAD_REF(ObjString, LOAD_REF(ObjFunction, method->function)->name);
+            break;
+        }
+        default:
+            return;
+    }
+    fprintf(file, ",\"%s\":", key);
+    writeString(file, name == NULL ? "script" : name->chars);
+}
+
+static void writeObject(Dump* dump, Reached* reached) {
+    FILE* file = dump->file;
+    Obj* object = reached->object;
+    fprintf(file, "{\"id\":%llu,\"type\":\"%s\",\"size\":%zu", (unsigned long long)(uintptr_t)object,
+            typeName(object->type), objectBytes(object));
+    writeName(file, object);
+    if (reached->root != NULL) {
+        fputs(",\"root\":", file);
+        writeString(file, reached->root);
+    } else {
+        fprintf(file, ",\"parent\":%llu", (unsigned long long)(uintptr_t)reached->parent);
+    }
+
+    fputs(",\"refs\":[", file);
+    dump->firstRef = true;
+    referFields(dump, object);
+    fputc(']', file);
+    if (object->type == OBJ_WEAK_REF || object->type == OBJ_WEAK_MAP) {
+        fputs(",\"weak\":[", file);
+        dump->firstRef = true;
+        writeWeakRefs(dump, object);
+        fputc(']', file);
+    }
+    fputs("}\n", file);
+}
+
+bool dumpHeap(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) return false;
+
+    Dump dump = {file, NULL, 0, 0, 0, true};
+    fputs("{\"format\":\"clox-heap\",\"version\":1}\n", file);
+    reachRoots(&dump);
+    // The queue is the walk's to-do list, and writing an object adds what it refers to onto the end
+    for (; dump.head < dump.count; dump.head++) {
+        writeObject(&dump, &dump.queue[dump.head]);
+        free(dump.queue[dump.head].root);
+    }
+    free(dump.queue);
+    heapClearMarks(&vm.heap);
+
+    bool written = !ferror(file);
+    return fclose(file) == 0 && written;
+}
+
+void dumpHeapOnRequest() {
+    static int dumpCount = 0;
+    heapDumpRequested = 0;
+    char path[64];
+#ifdef HEAPDUMP_USE_SIGNAL
+    snprintf(path, sizeof(path), "clox-heap-%d-%d.json", (int)getpid(), ++dumpCount);
+#else
+    snprintf(path, sizeof(path), "clox-heap-%d.json", ++dumpCount);
+#endif
+    if (dumpHeap(path)) {
+        fprintf(stderr, "Wrote a heap dump to %s\n", path);
+    } else {
+        fprintf(stderr, "Could not write a heap dump to %s\n", path);
+    }
+}
+
+#ifdef HEAPDUMP_USE_SIGNAL
+static void requestHeapDump(int signalNumber) {
+    heapDumpRequested = 1;
+}
+#endif
+
+void installHeapDumpSignal() {
+#ifdef HEAPDUMP_USE_SIGNAL
+    signal(SIGUSR2, requestHeapDump);
+#endif
+}
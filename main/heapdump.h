@@ -0,0 +1,44 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * Heap snapshots, for finding out what is keeping memory alive. A dump walks everything reachable from the same
+ * roots the GC marks from, breadth first, and writes one JSON object per line:
+ *
+ *     {"format":"clox-heap","version":1}
+ *     {"id":94811,"type":"instance","size":128,"class":"Node","root":"global list","refs":[94940,95068]}
+ *     {"id":94940,"type":"string","size":32,"parent":94811,"refs":[]}
+ *
+ * The first line says what the file is. After that each line is a live object:
+ * - id: its address, which is only unique within the one dump
+ * - type: instance, string, function, closure, upvalue, class, bound method, native, rope, weak ref or weak map
+ * - size: the bytes it takes up, including memory it owns outright, like the entries of an instance's fields
+ * - class: for instances, the name of their class. name: for classes, functions, closures and bound methods
+ * - refs: the ids of the objects it keeps alive. The values of a weak map count as kept alive by the map.
+ * - weak: the ids a weak ref or a weak map's keys refer to without keeping them alive, for those two types only
+ * - root or parent: how the walk first got to the object, which is along a shortest path from the roots. A root
+ *   describes where it was found, otherwise parent is the id of the object the walk came from, which is always on
+ *   an earlier line.
+ *
+ * tools/heapanalyze.c reads these back and works out what each object retains.
+ */
+#ifndef clox_heapdump_h
+#define clox_heapdump_h
+
+#include <signal.h>
+
+#include "common.h"
+
+// Set by SIGUSR2, and answered at the VM's next safepoint
+extern volatile sig_atomic_t heapDumpRequested;
+
+// Writes a snapshot of the live heap to 'path'. Doesn't allocate from the VM heap, so it can't set off a collection.
+// Returns false if the file couldn't be written.
+bool dumpHeap(const char* path);
+// Dumps to clox-heap-<pid>-<n>.json in the working directory, for a dump asked for by signal
+void dumpHeapOnRequest();
+// Has SIGUSR2 ask for a dump. Does nothing where there are no such signals.
+void installHeapDumpSignal();
+
+#endif
@@ -1,31 +1,160 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "common.h"
 #include "debug.h"
+#include "heapdump.h"
+#include "opstats.h"
+#include "profiler.h"
 #include "vm.h"
 
 static void repl();
 static void runFile(const char* path);
 static char* readFile(const char* path);
 
+typedef struct {
+    GCPacing pacing;
+    size_t heapLimit;
+    bool allocProfile;
+    // 0 to record every allocation
+    size_t allocSample;
+    // Samples per second for the profiler, 0 when it's off
+    int profileRate;
+} Options;
+
+static bool parseOption(const char* arg, Options* options);
+static void reportGCStats();
+static void reportAllocProfile();
+static void reportProfile();
+#ifdef DEBUG_OPCODE_STATS
+static void reportOpStats();
+#endif
+
+// Where --alloc-stacks writes the collapsed stacks, NULL for nowhere
+static const char* allocStacksPath = NULL;
+// Same for --profile-stacks
+static const char* profileStacksPath = NULL;
+
+static void usage() {
+    fprintf(stderr, "Usage: clox [options] [path]\n"
+                    "  --gc-stats               print what the GC did to stderr on exit\n"
+                    "  --alloc-profile          print which lines allocated the most to stderr on exit\n"
+                    "  --alloc-sample=SIZE      profile allocations by sampling one every SIZE bytes on average\n"
+                    "  --alloc-stacks=FILE      write the allocation profile to FILE as collapsed stacks\n"
+                    "  --profile                sample where the script spends its time, and report on exit\n"
+                    "  --profile-rate=HZ        sample HZ times per second of CPU time, 1000 by default\n"
+                    "  --profile-stacks=FILE    write the samples to FILE as collapsed stacks\n"
+                    "  --heap-limit=SIZE        fail the script once its heap needs more than SIZE bytes\n"
+                    "  --gc-min-heap=SIZE       never collect below SIZE bytes (K, M and G suffixes allowed)\n"
+                    "  --gc-target-heap=SIZE    try to keep the heap under SIZE bytes\n"
+                    "  --gc-cpu-budget=SHARE    adapt the heap growth to keep the GC to SHARE of CPU time, 0 to 1\n"
+                    "  --gc-grow=FACTOR         grow the heap to FACTOR times what survived each collection\n"
+                    "Sending the process SIGUSR2 makes it write a heap dump to clox-heap-<pid>-<n>.json.\n");
+    exit(64);
+}
+
 int main(int argc, const char* argv[]) {
     initVM();
+    installHeapDumpSignal();
+#ifdef DEBUG_OPCODE_STATS
+    atexit(reportOpStats);
+#endif
 
-    if (argc == 1) {
+    Options options;
+    initGCPacing(&options.pacing);
+    options.heapLimit = 0;
+    options.allocProfile = false;
+    options.allocSample = 0;
+    options.profileRate = 0;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        // Reported from an exit handler, so that scripts ending in an error get a report too
+        if (strcmp(argv[arg], "--gc-stats") == 0) {
+            atexit(reportGCStats);
+            continue;
+        }
+        if (strcmp(argv[arg], "--alloc-profile") == 0) {
+            options.allocProfile = true;
+            continue;
+        }
+        if (strcmp(argv[arg], "--profile") == 0) {
+            if (options.profileRate == 0) options.profileRate = PROFILE_DEFAULT_RATE;
+            continue;
+        }
+        if (!parseOption(argv[arg], &options)) usage();
+    }
+    setGCPacing(&options.pacing);
+    setHeapLimit(options.heapLimit);
+    if (options.allocProfile || options.allocSample > 0 || allocStacksPath != NULL) {
+        startAllocProfile(&vm.allocProfile, options.allocSample);
+        atexit(reportAllocProfile);
+    }
+    if (profileStacksPath != NULL && options.profileRate == 0) options.profileRate = PROFILE_DEFAULT_RATE;
+    if (options.profileRate > 0) {
+        if (!startProfiler(options.profileRate)) {
+            fprintf(stderr, "Could not start the profiler.\n");
+            exit(64);
+        }
+        atexit(reportProfile);
+    }
+
+    if (arg == argc) {
         repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
+    } else if (arg == argc - 1) {
+        runFile(argv[arg]);
     } else {
-        fprintf(stderr, "Usage: clox [path]\n");
-        exit(64);
+        usage();
     }
 
     freeVM();
     return 0;
 }
 
+static void reportGCStats() {
+    // Whatever the script printed comes first
+    fflush(stdout);
+    printGCStats(&vm.gcStats, stderr);
+}
+
+static void reportAllocProfile() {
+    fflush(stdout);
+    printAllocReport(&vm.allocProfile, stderr);
+    if (allocStacksPath != NULL) {
+        FILE* file = fopen(allocStacksPath, "w");
+        if (file == NULL) {
+            fprintf(stderr, "Could not write allocation stacks to \"%s\".\n", allocStacksPath);
+        } else {
+            writeAllocStacks(&vm.allocProfile, file);
+            fclose(file);
+        }
+    }
+    freeAllocProfile(&vm.allocProfile);
+}
+
+static void reportProfile() {
+    stopProfiler();
+    fflush(stdout);
+    printProfileReport(stderr);
+    if (profileStacksPath != NULL) {
+        FILE* file = fopen(profileStacksPath, "w");
+        if (file == NULL) {
+            fprintf(stderr, "Could not write profile stacks to \"%s\".\n", profileStacksPath);
+        } else {
+            writeProfileStacks(file);
+            fclose(file);
+        }
+    }
+}
+
+#ifdef DEBUG_OPCODE_STATS
+static void reportOpStats() {
+    fflush(stdout);
+    printOpStats(stderr);
+}
+#endif
+
 static void repl() {
     char line[1024];
 
@@ -78,3 +207,59 @@ static char* readFile(const char* path) {
     fclose(file);
     return buffer;
 }
+
+// Reads a byte count such as 64M, or returns false if 'text' isn't one
+static bool parseSize(const char* text, size_t* size) {
+    char* end;
+    double value = strtod(text, &end);
+    if (end == text || value < 0) return false;
+    switch (*end) {
+        case 'K': case 'k': value *= 1024; end++; break;
+        case 'M': case 'm': value *= 1024 * 1024; end++; break;
+        case 'G': case 'g': value *= 1024 * 1024 * 1024; end++; break;
+        default: break;
+    }
+    if (*end != '\0') return false;
+    *size = (size_t)value;
+    return true;
+}
+
+static bool parseFraction(const char* text, double* fraction) {
+    char* end;
+    *fraction = strtod(text, &end);
+    return end != text && *end == '\0';
+}
+
+static bool parseOption(const char* arg, Options* options) {
+    GCPacing* pacing = &options->pacing;
+    const char* value = strchr(arg, '=');
+    if (value == NULL) return false;
+    size_t length = value - arg;
+    value++;
+
+    if (length == 12 && memcmp(arg, "--heap-limit", 12) == 0) return parseSize(value, &options->heapLimit);
+    if (length == 13 && memcmp(arg, "--gc-min-heap", 13) == 0) return parseSize(value, &pacing->minHeap);
+    if (length == 16 && memcmp(arg, "--gc-target-heap", 16) == 0) return parseSize(value, &pacing->targetHeap);
+    if (length == 15 && memcmp(arg, "--gc-cpu-budget", 15) == 0) {
+        return parseFraction(value, &pacing->cpuBudget) && pacing->cpuBudget >= 0 && pacing->cpuBudget < 1;
+    }
+    if (length == 14 && memcmp(arg, "--alloc-sample", 14) == 0) return parseSize(value, &options->allocSample);
+    if (length == 14 && memcmp(arg, "--alloc-stacks", 14) == 0) {
+        allocStacksPath = value;
+        return *value != '\0';
+    }
+    if (length == 14 && memcmp(arg, "--profile-rate", 14) == 0) {
+        char* end;
+        long rate = strtol(value, &end, 10);
+        options->profileRate = (int)rate;
+        return end != value && *end == '\0' && rate > 0 && rate <= 1000000;
+    }
+    if (length == 16 && memcmp(arg, "--profile-stacks", 16) == 0) {
+        profileStacksPath = value;
+        return *value != '\0';
+    }
+    if (length == 9 && memcmp(arg, "--gc-grow", 9) == 0) {
+        return parseFraction(value, &pacing->growFactor) && pacing->growFactor > 1;
+    }
+    return false;
+}
@@ -5,6 +5,7 @@
 #include "memory.h"
 #include "vm.h"
 
+#include <stdatomic.h>
 #include <stdlib.h>
 
 #include <memory.h>
@@ -12,85 +13,174 @@
 #include "value.h"
 #include "object.h"
 #include "compiler.h"
+#include "stackmap.h"
+#include "opstats.h"
+#include "profiler.h"
 
 // Technically arbitrary, for performance ideally profile and test different factors
 #define GC_HEAP_GROW_FACTOR 2
+#define GC_MIN_HEAP (1024 * 1024)
+// Bounds on how growFactor may be set or adapted. Right above 1 the GC would run nearly nonstop.
+#define GC_MIN_GROW_FACTOR 1.25
+#define GC_MAX_GROW_FACTOR 16
+// Once what survives is close to the target heap, the heap may still grow this much past it before collecting again
+#define GC_TARGET_HEADROOM 1.1
+// How many gray objects are prefetched ahead of the one being blackened, and how many slots ahead an array or table
+// scan prefetches mark bits. Roughly how many misses it takes to cover one trip to memory.
+#define GC_PREFETCH_DISTANCE 8
+// Once compacting would give back this fraction of the object heap, the next safepoint does it
+#define GC_COMPACT_FRAGMENTATION 0.25
+// ...but small gains are never worth the trouble
+#define GC_COMPACT_MIN_BYTES (4 * HEAP_REGION_SIZE)
 
 #ifdef DEBUG_LOG_GC
 #include <stdio.h>
 #include "debug.h"
 #endif
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+static double clampGrowFactor(double factor) {
+    if (factor < GC_MIN_GROW_FACTOR) return GC_MIN_GROW_FACTOR;
+    if (factor > GC_MAX_GROW_FACTOR) return GC_MAX_GROW_FACTOR;
+    return factor;
+}
+
+void initGCPacing(GCPacing* pacing) {
+    pacing->minHeap = GC_MIN_HEAP;
+    pacing->targetHeap = 0;
+    pacing->cpuBudget = 0;
+    pacing->growFactor = GC_HEAP_GROW_FACTOR;
+}
+
+// Where the next collection goes, given what survived the last one
+static size_t nextCollectionAt(size_t survived) {
+    GCPacing* pacing = &vm.gcPacing;
+    size_t next = (size_t)(survived * pacing->growFactor);
+    if (pacing->targetHeap > 0 && next > pacing->targetHeap) {
+        size_t least = (size_t)(survived * GC_TARGET_HEADROOM);
+        next = least > pacing->targetHeap ? least : pacing->targetHeap;
+    }
+    if (next < pacing->minHeap) next = pacing->minHeap;
+    // Collecting right at the heap limit is the last chance to get back under it
+    if (vm.heapLimit > 0 && next > vm.heapLimit) next = vm.heapLimit;
+    return next;
+}
+
+void setGCPacing(const GCPacing* pacing) {
+    vm.gcPacing = *pacing;
+    if (vm.gcPacing.cpuBudget >= 1) vm.gcPacing.cpuBudget = 0;
+    vm.gcPacing.growFactor = clampGrowFactor(vm.gcPacing.growFactor);
+    vm.nextGC = nextCollectionAt(vm.bytesSurvived);
+}
+
+void setHeapLimit(size_t limit) {
+    vm.heapLimit = limit;
+    vm.nextGC = nextCollectionAt(vm.bytesSurvived);
+}
+
+// Sizes are what the heap really hands out for a request, so that the heap limit holds to actual memory
+static void trackAllocation(size_t oldSize, size_t newSize) {
     vm.bytesAllocated += newSize - oldSize;
-    if (newSize > oldSize) {
+    // Only growth may collect; frees happen during sweep, and a collection from inside sweep would be reentrant.
+    // The collector can allocate a little of its own too, which mustn't start another collection either.
+    if (newSize > oldSize && !vm.collecting) {
 #ifdef DEBUG_STRESS_GC
         collectGarbage();
 #endif
+        // Once out of memory, collecting again before the VM gets to raise the error would only thrash
+        if (vm.bytesAllocated >= vm.nextGC && !vm.outOfMemory) {
+            collectGarbage();
+            // The heap limit caps nextGC, so this may have been the last chance to get back under it. There's no
+            // unwinding from the middle of an allocation, so the allocation goes ahead and the VM raises the error
+            // at its next safepoint.
+            if (vm.heapLimit > 0 && vm.bytesAllocated > vm.heapLimit) vm.outOfMemory = true;
+        }
     }
+}
 
-    if (vm.bytesAllocated >= vm.nextGC) {
-        collectGarbage();
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    size_t oldFootprint = heapFootprint(oldSize, false);
+    size_t newFootprint = heapFootprint(newSize, false);
+    if (vm.allocProfile.enabled && newFootprint > oldFootprint) {
+        profileAllocation(&vm.allocProfile, ALLOC_ARRAY, newFootprint - oldFootprint);
     }
+    trackAllocation(oldFootprint, newFootprint);
+    // Small blocks come out of the heap's size class pools, anything bigger falls back to malloc
+    return heapReallocate(&vm.heap, pointer, oldSize, newSize);
+}
+
+void* reallocateObject(void* pointer, size_t oldSize, size_t newSize) {
+    trackAllocation(heapFootprint(oldSize, true), heapFootprint(newSize, true));
 
     if (newSize == 0) {
-        free(pointer);
+        heapFreeObject(&vm.heap, pointer, oldSize);
         return NULL;
     }
 
-    void* result = realloc(pointer, newSize);
-    if (result == NULL) exit(1);
-    return result;
+    return heapAllocateObject(&vm.heap, newSize);
 }
 
-static void freeObject(Obj* object) {
+static void freeObject(void* pointer) {
+    Obj* object = (Obj*)pointer;
 #ifdef DEBUG_LOG_GC
     printf("%p freed, type %d\n", (void*)object, object->type);
 #endif
     switch (object->type) {
         case OBJ_STRING: {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length+1);
-            FREE(ObjString, object);
+            reallocateObject(object, SIZEOF_STRING(string->length), 0);
             break;
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*) object;
             freeChunk(&function->chunk);
-            FREE(ObjFunction, object);
+            FREE_OBJ(ObjFunction, object);
             break;
         }
         case OBJ_NATIVE: {
-            FREE(ObjNative, object);
+            FREE_OBJ(ObjNative, object);
             break;
         }
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)object;
-            FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
             // Only frees the surrounding enclosure since multiple closures can contain the same exact function
-            FREE(ObjClosure, object);
+            reallocateObject(object, SIZEOF_CLOSURE(closure->upvalueCount), 0);
             break;
         }
         // Multiple closures could refer to the same value the upvalue refers to, so here we only free the wrapping struct
         case OBJ_UPVALUE: {
-            FREE(ObjUpvalue, object);
+            FREE_OBJ(ObjUpvalue, object);
             break;
         }
         case OBJ_CLASS: {
             // The name itself might still be in use
             ObjClass* klass = (ObjClass*)object;
             freeTable(&klass->methods);
-            FREE(ObjClass, object);
+            FREE_OBJ(ObjClass, object);
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)object;
             freeTable(&instance->fields);
-            FREE(ObjInstance, object);
+            FREE_OBJ(ObjInstance, object);
             break;
         }
         case OBJ_BOUND_METHOD: {
-            FREE(ObjBoundMethod, object);
+            FREE_OBJ(ObjBoundMethod, object);
+            break;
+        }
+        // The pieces are objects of their own
+        case OBJ_ROPE: {
+            FREE_OBJ(ObjRope, object);
+            break;
+        }
+        case OBJ_WEAK_REF: {
+            FREE_OBJ(ObjWeakRef, object);
+            break;
+        }
+        case OBJ_WEAK_MAP: {
+            ObjWeakMap* map = (ObjWeakMap*)object;
+            freeEphemeronTable(&map->table);
+            FREE_OBJ(ObjWeakMap, object);
             break;
         }
     }
@@ -98,8 +188,8 @@ static void freeObject(Obj* object) {
 
 void markObject(Obj* obj) {
     // Second condition avoids cycles
-    if (obj == NULL || obj->isMarked) return;
-    obj->isMarked = true;
+    if (obj == NULL || heapIsMarked(obj)) return;
+    heapSetMarked(obj);
 
     if (vm.grayCapacity < vm.grayCount + 1) {
         vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
@@ -124,22 +214,46 @@ void markValue(Value val) {
 
 static void markArray(ValueArray* array) {
     for (int i = 0; i < array->count; i++) {
+        if (i + GC_PREFETCH_DISTANCE < array->count) {
+            Value ahead = array->values[i + GC_PREFETCH_DISTANCE];
+            if (IS_OBJ(ahead)) heapPrefetchMark(AS_OBJ(ahead));
+        }
         markValue(array->values[i]);
     }
 }
 
+// Empties the slots of the locals each frame's function is done with, see stackmap.h
+static void wipeDeadSlots() {
+    for (int i = 0; i < vm.frameCount; i++) {
+        CallFrame* frame = &vm.frames[i];
+        Chunk* chunk = &LOAD_REF(ObjFunction, frame->closure->function)->chunk;
+        StackMapEntry* entry = findStackMapEntry(&chunk->stackMap, (int)(frame->ip - chunk->code));
+        if (entry == NULL) continue;
+        // Anything at or past where the next frame starts belongs to that frame
+        Value* limit = i + 1 < vm.frameCount ? vm.frames[i + 1].slots : vm.stackTop;
+        for (int j = 0; j < entry->deadCount; j++) {
+            Value* slot = &frame->slots[chunk->stackMap.deadSlots[entry->deadStart + j]];
+            if (slot < limit) *slot = NIL_VAL;
+        }
+    }
+}
+
 static void markRoots() {
+    wipeDeadSlots();
     for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
         markValue(*slot);
     }
     // We intentionally do not mark our table of interned strings, since they are a little special.
     // Marking them normally would lead to us never collecting any strings
     // manually marking is also bad since we would just have a bunch of dangling pointers
+    for (int i = 0; i < vm.handleCount; i++) {
+        markValue(vm.handles[i]);
+    }
     markTable(&vm.globals);
     for (int i = 0; i < vm.frameCount; i++) {
         markObject((Obj*)vm.frames[i].closure);
     }
-    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+    for (ObjUpvalue* upvalue = vm.openUpvalues; upvalue != NULL; upvalue = LOAD_REF(ObjUpvalue, upvalue->next)) {
         markObject((Obj*)upvalue);
     }
     markCompilerRoots();
@@ -147,7 +261,7 @@ static void markRoots() {
     markObject((Obj*)vm.initString);
 }
 
-// A black object is any object whose 'isMarked' field is set, and is no longer in the gray stack of the vm
+// A black object is any object whose mark bit is set, and is no longer in the gray stack of the vm
 static void blackenObject(Obj* obj) {
 #ifdef DEBUG_LOG_GC
     printf("%p blacken ", (void*)obj);
@@ -163,35 +277,55 @@ static void blackenObject(Obj* obj) {
         }
         case OBJ_FUNCTION: {
             ObjFunction* function = (ObjFunction*)obj;
-            markObject((Obj*)function->name);
+            markObject(LOAD_REF(Obj, function->name));
             markArray(&function->chunk.constants);
             break;
         }
         case OBJ_CLOSURE: {
             ObjClosure* closure = (ObjClosure*)obj;
-            markObject((Obj*)closure->function);
+            markObject(LOAD_REF(Obj, closure->function));
             for (int i = 0; i < closure->upvalueCount; i++) {
-                markObject((Obj*)closure->upvalues[i]);
+                markObject(LOAD_REF(Obj, closure->upvalues[i]));
 
             }
             break;
         }
         case OBJ_CLASS: {
             ObjClass* klass = (ObjClass*)obj;
-            markObject((Obj*)klass->name);
+            markObject(LOAD_REF(Obj, klass->name));
             markTable(&klass->methods);
             break;
         }
         case OBJ_INSTANCE: {
             ObjInstance* instance = (ObjInstance*)obj;
-            markObject((Obj*)instance->klass);
+            markObject(LOAD_REF(Obj, instance->klass));
             markTable(&instance->fields);
             break;
         }
         case OBJ_BOUND_METHOD: {
             ObjBoundMethod* method = (ObjBoundMethod*)obj;
             markValue(method->receiver);
-            markObject((Obj*)method->method);
+            markObject(LOAD_REF(Obj, method->method));
+            break;
+        }
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)obj;
+            markObject(LOAD_REF(Obj, rope->left));
+            markObject(LOAD_REF(Obj, rope->right));
+            markObject(LOAD_REF(Obj, rope->flat));
+            break;
+        }
+        // Nothing gets marked through these, they wait until marking is otherwise done (see traceEphemerons())
+        case OBJ_WEAK_REF: {
+            ObjWeakRef* ref = (ObjWeakRef*)obj;
+            ref->nextWeak = heapPack(vm.weakRefs);
+            vm.weakRefs = ref;
+            break;
+        }
+        case OBJ_WEAK_MAP: {
+            ObjWeakMap* map = (ObjWeakMap*)obj;
+            map->nextWeak = heapPack(vm.weakMaps);
+            vm.weakMaps = map;
             break;
         }
         // Nothing to do
@@ -201,44 +335,222 @@ static void blackenObject(Obj* obj) {
     }
 }
 
+/**
+ * Gray objects were last touched when they were pushed, often long ago, so blackening each one as soon as it's popped
+ * would mostly wait on memory. Instead, popped objects are prefetched and queue up in a small ring, and only the one
+ * that has spent longest in the ring is blackened, by which time it has hopefully arrived in cache.
+ */
 static void traceReferences() {
-    while (vm.grayCount > 0) {
-        Obj* object = vm.grayStack[--vm.grayCount];
+    Obj* ring[GC_PREFETCH_DISTANCE];
+    int head = 0;
+    int queued = 0;
+
+    while (vm.grayCount > 0 || queued > 0) {
+        while (vm.grayCount > 0 && queued < GC_PREFETCH_DISTANCE) {
+            Obj* object = vm.grayStack[--vm.grayCount];
+            __builtin_prefetch(object, 0);
+            ring[(head + queued++) % GC_PREFETCH_DISTANCE] = object;
+        }
+
+        Obj* object = ring[head];
+        head = (head + 1) % GC_PREFETCH_DISTANCE;
+        queued--;
         blackenObject(object);
     }
 }
 
-void freeObjects() {
-    Obj* object = vm.objs;
-    while (object != NULL) {
-        Obj* next = object->next;
-        freeObject(object);
-        object = next;
+/**
+ * Once everything reachable the usual way is marked, a weak map's entries whose keys made it keep their values alive.
+ * Marking those values can make more keys reachable, including in maps reached only just now, so this goes around
+ * until a pass over every map marks nothing new.
+ */
+static void traceEphemerons() {
+    bool marked = true;
+    while (marked) {
+        marked = false;
+        for (ObjWeakMap* map = vm.weakMaps; map != NULL; map = LOAD_REF(ObjWeakMap, map->nextWeak)) {
+            if (markEphemerons(&map->table)) marked = true;
+        }
+        traceReferences();
     }
+}
+
+// Lets go of everything only weak references and weak map keys were holding on to
+static void clearWeakReferences() {
+    for (ObjWeakRef* ref = vm.weakRefs; ref != NULL; ref = LOAD_REF(ObjWeakRef, ref->nextWeak)) {
+        if (IS_OBJ(ref->target) && !heapIsMarked(AS_OBJ(ref->target))) ref->target = NIL_VAL;
+    }
+    for (ObjWeakMap* map = vm.weakMaps; map != NULL; map = LOAD_REF(ObjWeakMap, map->nextWeak)) {
+        ephemeronRemoveWhite(&map->table);
+        // Caches churning through short lived keys would otherwise only ever grow
+        ephemeronTrim(&map->table);
+    }
+    vm.weakRefs = NULL;
+    vm.weakMaps = NULL;
+}
+
+void freeObjects() {
+    heapEachObject(&vm.heap, freeObject);
 
     free(vm.grayStack);
 }
 
 static void sweep() {
-    Obj* previous = NULL;
-    Obj* obj = vm.objs;
-    while (obj != NULL) {
-        if (obj->isMarked) {
-            obj->isMarked = false;
-            previous = obj;
-            obj = obj->next;
-        } else {
-            Obj* unreached = obj;
-            obj = obj->next;
-            if (previous != NULL) {
-                previous->next = obj;
-            } else {
-                vm.objs = obj;
+    // The heap hands us every object the trace didn't reach, straight from its bitmaps
+    heapSweep(&vm.heap, freeObject);
+}
+
+static void forwardValue(Value* value) {
+    if (IS_OBJ(*value)) value->as.obj = heapForward(value->as.obj);
+}
+
+static void forwardArray(ValueArray* array) {
+    for (int i = 0; i < array->count; i++) {
+        forwardValue(&array->values[i]);
+    }
+}
+
+// Points an object field declared with HEAP_REF at where its target lives now
+#define FORWARD_REF(ref) ((ref) = heapPack(heapForward(heapUnpack(ref))))
+
+// The compaction counterpart of blackenObject(): points every reference held by obj at where its target lives now
+static void forwardObjectFields(void* pointer) {
+    Obj* obj = (Obj*)pointer;
+    switch (obj->type) {
+        case OBJ_UPVALUE: {
+            ObjUpvalue* upvalue = (ObjUpvalue*)obj;
+            forwardValue(&upvalue->closed);
+            FORWARD_REF(upvalue->next);
+            // A closed upvalue points at its own 'closed' field, which may have just moved with it
+            if (upvalue->location < vm.stack || upvalue->location >= vm.stack + STACK_MAX) {
+                upvalue->location = &upvalue->closed;
+            }
+            break;
+        }
+        case OBJ_FUNCTION: {
+            ObjFunction* function = (ObjFunction*)obj;
+            FORWARD_REF(function->name);
+            forwardArray(&function->chunk.constants);
+            break;
+        }
+        case OBJ_CLOSURE: {
+            ObjClosure* closure = (ObjClosure*)obj;
+            FORWARD_REF(closure->function);
+            for (int i = 0; i < closure->upvalueCount; i++) {
+                FORWARD_REF(closure->upvalues[i]);
             }
+            break;
+        }
+        case OBJ_CLASS: {
+            ObjClass* klass = (ObjClass*)obj;
+            FORWARD_REF(klass->name);
+            forwardTable(&klass->methods);
+            break;
+        }
+        case OBJ_INSTANCE: {
+            ObjInstance* instance = (ObjInstance*)obj;
+            FORWARD_REF(instance->klass);
+            forwardTable(&instance->fields);
+            break;
+        }
+        case OBJ_BOUND_METHOD: {
+            ObjBoundMethod* method = (ObjBoundMethod*)obj;
+            forwardValue(&method->receiver);
+            FORWARD_REF(method->method);
+            break;
+        }
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)obj;
+            FORWARD_REF(rope->left);
+            FORWARD_REF(rope->right);
+            FORWARD_REF(rope->flat);
+            break;
+        }
+        case OBJ_WEAK_REF: {
+            forwardValue(&((ObjWeakRef*)obj)->target);
+            break;
+        }
+        case OBJ_WEAK_MAP: {
+            forwardEphemerons(&((ObjWeakMap*)obj)->table);
+            break;
+        }
+        case OBJ_NATIVE:
+        case OBJ_STRING:
+            break;
+    }
+}
+
+// Every place markRoots() looks at, plus every object left in the heap
+static void forwardReferences() {
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        forwardValue(slot);
+    }
+    for (int i = 0; i < vm.handleCount; i++) {
+        forwardValue(&vm.handles[i]);
+    }
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].closure = heapForward(vm.frames[i].closure);
+    }
+    vm.openUpvalues = heapForward(vm.openUpvalues);
+    vm.initString = heapForward(vm.initString);
+    forwardTable(&vm.globals);
+    forwardTable(&vm.strings);
 
-            freeObject(unreached);
+    // After a sweep only live objects are left, and the evacuated copies are among them
+    heapEachObject(&vm.heap, forwardObjectFields);
+}
+
+/**
+ * Sets the threshold for the next collection once one has finished. With a CPU budget, the grow factor is first
+ * re-derived from the cycle just done: a collection costs about as much as there was left to mark, so keeping the
+ * collector within its share means letting the mutator run long enough in between, and at the rate it was allocating
+ * that takes a heap of a certain size. The new factor is averaged with the old one so a single odd cycle can't swing it.
+ */
+static void scheduleNextCollection(size_t allocatedBefore, clock_t started) {
+    clock_t finished = clock();
+    size_t survived = vm.bytesAllocated;
+    GCPacing* pacing = &vm.gcPacing;
+
+    if (pacing->cpuBudget > 0 && survived > 0 && allocatedBefore > vm.bytesSurvived) {
+        double gcTime = (double)(finished - started);
+        double mutatorTime = (double)(started - vm.lastCollectionEnd);
+        if (gcTime > 0 && mutatorTime > 0) {
+            double allocationRate = (allocatedBefore - vm.bytesSurvived) / mutatorTime;
+            // How long the mutator should run before the next collection, which should cost about what this one did
+            double runFor = gcTime * (1 - pacing->cpuBudget) / pacing->cpuBudget;
+            double wanted = 1 + allocationRate * runFor / survived;
+            pacing->growFactor = clampGrowFactor((pacing->growFactor + wanted) / 2);
         }
     }
+
+    vm.bytesSurvived = survived;
+    vm.nextGC = nextCollectionAt(survived);
+    vm.lastCollectionEnd = finished;
+}
+
+// The part every collection shares: trace everything reachable, drop whatever wasn't from the intern table and the
+// weak references, and free it. Times each phase as it goes.
+static void markAndSweep(GCPhaseTimes* times) {
+    uint64_t start = gcClock();
+    // Marks the "roots" of the dyanmic memory as grey
+    markRoots();
+    // Steps 3 and 4
+    traceReferences();
+    traceEphemerons();
+    clearWeakReferences();
+
+    uint64_t marked = gcClock();
+    tableRemoveWhite(&vm.strings);
+    // A burst of dead strings can leave the intern table oversized and full of tombstones
+    tableTrim(&vm.strings);
+
+    uint64_t cleaned = gcClock();
+    // step 5
+    sweep();
+
+    times->mark = marked - start;
+    times->strings = cleaned - marked;
+    times->sweep = gcClock() - cleaned;
 }
 
 // The main garbage collection funtion
@@ -268,20 +580,98 @@ void collectGarbage() {
     printf("-- gc begin\n");
     size_t prev = vm.bytesAllocated;
 #endif
+    // Samples point at functions, which may be freed by this collection. Any sample taken once collecting is set
+    // stays out of the frames, so setting it first means the drain leaves nothing behind for them.
+    vm.collecting = true;
+    atomic_signal_fence(memory_order_seq_cst);
+    drainProfile();
+#ifdef DEBUG_OPCODE_STATS
+    flushInstructionSites();
+#endif
+    clock_t started = clock();
+    uint64_t startTime = gcClock();
+    size_t allocatedBefore = vm.bytesAllocated;
+    GCPhaseTimes times = {0};
 
-    // Marks the "roots" of the dyanmic memory as grey
-    markRoots();
-    // Steps 3 and 4
-    traceReferences();
-    tableRemoveWhite(&vm.strings);
-    // step 5
-    sweep();
+    markAndSweep(&times);
 
-    vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+    // A program that keeps refilling the same holes would bring the heap straight back to where the last compaction
+    // found it, so compacting again only pays once the heap has outgrown that.
+    // Objects can only move where no C code is holding a raw pointer to one, so compaction waits for a safepoint.
+    uint64_t sweepTime = gcClock();
+    HeapUsage usage;
+    heapMeasure(&vm.heap, &usage);
+    if (usage.reclaimableBytes >= GC_COMPACT_MIN_BYTES
+        && usage.reclaimableBytes > usage.objectBytes * GC_COMPACT_FRAGMENTATION
+        && usage.objectBytes > vm.compactedFrom) {
+        vm.compactRequested = true;
+        vm.compactedFrom = usage.objectBytes;
+    }
+    // Survivors are unmarked in bulk, without touching the objects themselves
+    heapClearMarks(&vm.heap);
+    heapReleaseEmpty(&vm.heap);
+
+    scheduleNextCollection(allocatedBefore, started);
+    // Everything has to be back in place before a sample may follow the frames again
+    atomic_signal_fence(memory_order_seq_cst);
+    vm.collecting = false;
+    uint64_t endTime = gcClock();
+    times.sweep += endTime - sweepTime;
+    times.pause = endTime - startTime;
+    recordCollection(&vm.gcStats, &times, allocatedBefore - vm.bytesAllocated, vm.bytesAllocated, false);
 
 #ifdef DEBUG_LOG_GC
     printf("-- gc end\n");
     printf("    Collected %zu bytes (from %zu to %zu) next at %zu\n",
         prev-vm.bytesAllocated, prev, vm.bytesAllocated, vm.nextGC);
 #endif
-}
\ No newline at end of file
+}
+
+/**
+ * A full collection that also defragments the object heap: after the sweep, every live object in a sparse region
+ * is moved into the holes of denser ones, and then every reference to it is updated. The emptied regions are reused.
+ *
+ * Must only be called from a safepoint of the interpreter loop, where nothing but the VM itself holds on to objects.
+ */
+void compactHeap() {
+#ifdef DEBUG_LOG_GC
+    printf("-- compact begin\n");
+#endif
+    // Samples point at functions, which may be moved by this collection. See collectGarbage() for the order.
+    vm.collecting = true;
+    atomic_signal_fence(memory_order_seq_cst);
+    drainProfile();
+#ifdef DEBUG_OPCODE_STATS
+    flushInstructionSites();
+#endif
+    clock_t started = clock();
+    uint64_t startTime = gcClock();
+    size_t allocatedBefore = vm.bytesAllocated;
+    vm.compactRequested = false;
+    GCPhaseTimes times = {0};
+
+    markAndSweep(&times);
+
+    uint64_t compactTime = gcClock();
+    if (heapEvacuate(&vm.heap)) {
+        forwardReferences();
+        heapReleaseEvacuated(&vm.heap);
+    }
+    uint64_t sweepTime = gcClock();
+    heapClearMarks(&vm.heap);
+    heapReleaseEmpty(&vm.heap);
+
+    scheduleNextCollection(allocatedBefore, started);
+    // Everything has to be back in place before a sample may follow the frames again
+    atomic_signal_fence(memory_order_seq_cst);
+    vm.collecting = false;
+    uint64_t endTime = gcClock();
+    times.compact = sweepTime - compactTime;
+    times.sweep += endTime - sweepTime;
+    times.pause = endTime - startTime;
+    recordCollection(&vm.gcStats, &times, allocatedBefore - vm.bytesAllocated, vm.bytesAllocated, true);
+
+#ifdef DEBUG_LOG_GC
+    printf("-- compact end\n");
+#endif
+}
@@ -27,6 +27,25 @@
 
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+#define FREE_OBJ(type, pointer) reallocateObject(pointer, sizeof(type), 0)
+
+/**
+ * Decides how big the heap gets before the next collection. Left to its defaults, the heap grows to twice what
+ * survived the last collection, but never collects below 1 MB.
+ */
+typedef struct {
+    // Never collect before the heap has reached this many bytes. Wins over targetHeap.
+    size_t minHeap;
+    // If set, collect as soon as the heap reaches this many bytes. Once what survives gets close to it, the heap is
+    // let past it a little at a time rather than collecting nonstop.
+    size_t targetHeap;
+    // If set, the share of CPU time the collector may take, between 0 and 1. growFactor is then adjusted after every
+    // collection to keep to it, going by how costly the last mark was and how much survived it.
+    double cpuBudget;
+    // How far past what survived the last collection the heap may grow before the next one
+    double growFactor;
+} GCPacing;
+
 /**
  * Reallocate a new chunk of size newSize
  * @param pointer A pointer to the old chunk
@@ -41,11 +60,21 @@
  * oldSize != 0 && newSize > oldSize should grow the existing allocation
  */
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+// Same contract as reallocate(), but for Obj memory, which lives in the GC heap. Objects never change size,
+// so only the allocate and free cases are valid.
+void* reallocateObject(void* pointer, size_t oldSize, size_t newSize);
 // Helpers for garbage collector
 void markObject(Obj* obj);
 void markValue(Value value);
+// Fills in the default pacing
+void initGCPacing(GCPacing* pacing);
+// Switches the VM over to 'pacing', which applies from the next allocation on
+void setGCPacing(const GCPacing* pacing);
+// Caps how many bytes the heap may hold, 0 for no limit. Going over it makes the script fail with a runtime error.
+void setHeapLimit(size_t limit);
 // THE garbage collection function.
 void collectGarbage();
+void compactHeap();
 void freeObjects();
 
 #endif
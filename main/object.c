@@ -2,8 +2,11 @@
 // Created by aaron on 8/19/2024.
 //
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "handles.h"
 #include "memory.h"
 #include "object.h"
 #include "value.h"
@@ -16,34 +19,30 @@ extern VM vm;
 (type*)allocateObject(sizeof(type), objectType)
 
 static Obj* allocateObject(size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = (Obj*)reallocateObject(NULL, 0, size);
     object->type = type;
-    object->next = vm.objs;
-    object->isMarked = false;
-    vm.objs = object;
+    if (vm.allocProfile.enabled) profileAllocation(&vm.allocProfile, type, heapFootprint(size, true));
 #ifdef DEBUG_LOG_GC
     printf("%p allocate %zu for %d\n", (void*)object, size, type);
 #endif
     return object;
 }
 
-ObjClass* newCLass(ObjString* name) {
+ObjClass* newClass(ObjString* name) {
     // variable name of "klass" makes this c++ compatible
     ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
-    klass->name = name;
+    klass->name = heapPack(name);
     initTable(&klass->methods);
     return klass;
 }
 
 ObjClosure* newClosure(ObjFunction* function) {
-    ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
+    ObjClosure* closure = (ObjClosure*)allocateObject(SIZEOF_CLOSURE(function->upvalueCount), OBJ_CLOSURE);
+    closure->function = heapPack(function);
+    closure->upvalueCount = function->upvalueCount;
     for (int i = 0; i < function->upvalueCount; i++) {
-        upvalues[i] = NULL;
+        closure->upvalues[i] = heapPack(NULL);
     }
-    ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
-    closure->function = function;
-    closure->upvalueCount = function->upvalueCount;
-    closure->upvalues = upvalues;
     return closure;
 }
 
@@ -54,7 +53,7 @@ ObjClosure* newClosure(ObjFunction* function) {
 ObjFunction* newFunction() {
     ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
-    function->name = NULL;
+    function->name = heapPack(NULL);
     function->upvalueCount = 0;
     initChunk(&function->chunk);
     return function;
@@ -64,7 +63,7 @@ ObjFunction* newFunction() {
 ObjInstance* newInstance(ObjClass* klass) {
     ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
     initTable(&instance->fields);
-    instance->klass = klass;
+    instance->klass = heapPack(klass);
     return instance;
 }
 
@@ -87,43 +86,117 @@ ObjNative* newNative(NativeFn function) {
  */
 ObjBoundMethod* newBoundMethod(ObjClosure* method, Value receiver) {
     ObjBoundMethod* bound_method = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
-    bound_method->method = method;
+    bound_method->method = heapPack(method);
     bound_method->receiver = receiver;
     return bound_method;
 }
 
+ObjWeakRef* newWeakRef(Value target) {
+    ObjWeakRef* ref = ALLOCATE_OBJ(ObjWeakRef, OBJ_WEAK_REF);
+    ref->target = target;
+    ref->nextWeak = heapPack(NULL);
+    return ref;
+}
+
+ObjWeakMap* newWeakMap() {
+    ObjWeakMap* map = ALLOCATE_OBJ(ObjWeakMap, OBJ_WEAK_MAP);
+    initEphemeronTable(&map->table);
+    map->nextWeak = heapPack(NULL);
+    return map;
+}
+
 /**
- * Allocates a Lox String, and interns it for future lookup
- * @param chars The raw C string we are allocating
+ * Allocates a Lox String with room for length characters, which the caller fills in. It starts out un-interned.
  * @param length tne length of said string
- * @param hash The hash of said string
  * @return A pointer to the newly allocated Lox String
  */
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+ObjString* allocateString(int length) {
+    ObjString* string = (ObjString*)allocateObject(SIZEOF_STRING(length), OBJ_STRING);
     string->length = length;
-    string->chars = chars;
+    string->hash = 0;
+    string->interned = false;
+    string->chars[length] = '\0';
+    return string;
+}
+
+// Records a freshly filled in string in the intern table
+static ObjString* addString(ObjString* string, uint32_t hash) {
     string->hash = hash;
-    push(OBJ_VAL(string));
+    string->interned = true;
+    HandleScope scope = openHandleScope();
+    Handle handle = newHandle(OBJ_VAL(string));
     // String interning: Causes slight perf overhead for every allocation, but greatly improves performance when
     // Doing comoparisons (checking for function names)
-    tableSet(&vm.strings, string, NIL_VAL);
-    pop();
+    tableSet(&vm.strings, AS_STRING(*handle), NIL_VAL);
+    string = AS_STRING(*handle);
+    closeHandleScope(scope);
     return string;
 }
 
+// Odd 64 bit constants with well spread out bits, the same ones wyhash uses
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+
+// Chosen once per process, so a script can't be written ahead of time to make all of its strings collide
+static uint64_t hashSeed = 0;
+
+// Multiplies out to 128 bits and folds the halves back together, so every input bit affects every output bit
+static uint64_t hashMix(uint64_t a, uint64_t b) {
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static uint64_t readWord(const uint8_t* bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+static uint64_t readHalfWord(const uint8_t* bytes) {
+    uint32_t word;
+    memcpy(&word, bytes, sizeof(word));
+    return word;
+}
+
+void seedStringHash() {
+    if (hashSeed != 0) return;
+    // Whatever differs from one run to the next: the time, and wherever ASLR put us
+    hashSeed = hashMix((uint64_t)time(NULL) ^ HASH_P0, (uint64_t)(uintptr_t)&hashSeed ^ (uint64_t)clock()) | 1;
+}
+
 /**
- * Hashes a given string, using the FNV-1A hash function: https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function
+ * Hashes a given string 16 bytes at a time, in the style of wyhash: https://github.com/wangyi-fudan/wyhash
  * @param key The key we are hashing
  * @param length The number of characters to use when hashing
  * @return
  */
 static uint32_t hashString(const char* key, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i];
-        hash ^= 16777619;
+    const uint8_t* bytes = (const uint8_t*)key;
+    uint64_t hash = hashSeed;
+
+    int remaining = length;
+    while (remaining > 16) {
+        hash = hashMix(readWord(bytes) ^ HASH_P1, readWord(bytes + 8) ^ hash);
+        bytes += 16;
+        remaining -= 16;
     }
+
+    // The last 16 bytes or fewer, read as two words that overlap when there are less than 16 of them.
+    // Short tails get the same treatment with smaller reads, so nothing is read past the end of the string.
+    uint64_t low = 0;
+    uint64_t high = 0;
+    if (remaining >= 8) {
+        low = readWord(bytes);
+        high = readWord(bytes + remaining - 8);
+    } else if (remaining >= 4) {
+        low = readHalfWord(bytes);
+        high = readHalfWord(bytes + remaining - 4);
+    } else if (remaining > 0) {
+        low = ((uint64_t)bytes[0] << 16) | ((uint64_t)bytes[remaining / 2] << 8) | bytes[remaining - 1];
+    }
+    hash = hashMix(hashMix(low ^ HASH_P1, high ^ hash) ^ HASH_P2, (uint64_t)length ^ HASH_P1);
+    return (uint32_t)(hash ^ (hash >> 32));
 }
 
 /**
@@ -138,27 +211,92 @@ ObjString* copyString(const char* chars, int length) {
     ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
     if (interned != NULL) return interned;
     // We have not, so we manually allocate enough space for the string and mark it as seen
-    char* heapChars = ALLOCATE(char, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
-    return allocateString(heapChars, length, hash);
+    ObjString* string = allocateString(length);
+    memcpy(string->chars, chars, length);
+    return addString(string, hash);
+}
+
+bool stringsEqual(ObjString* a, ObjString* b) {
+    if (a == b) return true;
+    // There is only one interned copy of any string
+    if (a->interned && b->interned) return false;
+    return a->length == b->length && memcmp(a->chars, b->chars, a->length) == 0;
+}
+
+ObjRope* newRope(Obj* left, Obj* right, int length) {
+    ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->length = length;
+    rope->left = heapPack(left);
+    rope->right = heapPack(right);
+    rope->flat = heapPack(NULL);
+    return rope;
+}
+
+/**
+ * Copies every character a rope stands for into dest, which needs room for rope->length of them.
+ * Ropes can be nested far too deeply to recurse on, so this keeps its own stack. Going right to left, a rope built
+ * by appending one piece at a time never needs more than a couple of entries on it.
+ */
+static void copyRope(ObjRope* rope, char* dest) {
+    int capacity = 8;
+    int count = 0;
+    Obj** stack = (Obj**)malloc(sizeof(Obj*) * capacity);
+    if (stack == NULL) exit(1);
+    stack[count++] = (Obj*)rope;
+
+    char* end = dest + rope->length;
+    while (count > 0) {
+        Obj* piece = stack[--count];
+        if (piece->type == OBJ_ROPE && heapUnpack(((ObjRope*)piece)->flat) != NULL) {
+            piece = LOAD_REF(Obj, ((ObjRope*)piece)->flat);
+        }
+
+        if (piece->type == OBJ_STRING) {
+            ObjString* string = (ObjString*)piece;
+            end -= string->length;
+            memcpy(end, string->chars, string->length);
+            continue;
+        }
+
+        if (capacity < count + 2) {
+            capacity = GROW_CAPACITY(capacity);
+            stack = (Obj**)realloc(stack, sizeof(Obj*) * capacity);
+            if (stack == NULL) exit(1);
+        }
+        // The right half gets popped, and copied, first
+        stack[count++] = LOAD_REF(Obj, ((ObjRope*)piece)->left);
+        stack[count++] = LOAD_REF(Obj, ((ObjRope*)piece)->right);
+    }
+    free(stack);
+}
+
+ObjString* flattenRope(ObjRope* rope) {
+    if (heapUnpack(rope->flat) != NULL) return LOAD_REF(ObjString, rope->flat);
+    // The rope itself keeps its pieces alive while the string is being allocated
+    ObjString* string = allocateString(rope->length);
+    copyRope(rope, string->chars);
+    rope->flat = heapPack(string);
+    // The pieces aren't needed anymore, let the GC have them
+    rope->left = heapPack(NULL);
+    rope->right = heapPack(NULL);
+    return string;
 }
 
 ObjUpvalue* newUpvalue(Value* slot) {
     ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
     upvalue->location = slot;
-    upvalue->next = NULL;
+    upvalue->next = heapPack(NULL);
     upvalue->closed = NIL_VAL;
     return upvalue;
 }
 
 static void printFunction(ObjFunction* function) {
     // handles the special case of the vm's own allocated function slot
-    if (function->name == NULL) {
+    if (heapUnpack(function->name) == NULL) {
         printf("<script>");
         return;
     }
-    printf("<fn> %s", function->name->chars);
+    printf("<fn> %s", LOAD_REF(ObjString, function->name)->chars);
 }
 
 /**
@@ -180,7 +318,7 @@ void printObject(Value value) {
             break;
         }
         case OBJ_CLOSURE: {
-            printFunction(AS_CLOSURE(value)->function);
+            printFunction(LOAD_REF(ObjFunction, AS_CLOSURE(value)->function));
             break;
         }
         // Not particularly useful to an end user, probably will never be called realistically.
@@ -189,26 +327,40 @@ void printObject(Value value) {
             break;
         }
         case OBJ_CLASS: {
-            printf("Class %s", AS_CLASS(value)->name->chars);
+            printf("Class %s", LOAD_REF(ObjString, AS_CLASS(value)->name)->chars);
             break;
         }
         case OBJ_INSTANCE: {
-            printf("Instance of %s", AS_INSTANCE(value)->klass->name->chars);
+            ObjClass* klass = LOAD_REF(ObjClass, AS_INSTANCE(value)->klass);
+            printf("Instance of %s", LOAD_REF(ObjString, klass->name)->chars);
+            break;
         }
         case OBJ_BOUND_METHOD: {
-            printFunction(AS_BOUND(value)->method->function);
+            printFunction(LOAD_REF(ObjFunction, LOAD_REF(ObjClosure, AS_BOUND(value)->method)->function));
+            break;
+        }
+        case OBJ_ROPE: {
+            ObjRope* rope = AS_ROPE(value);
+            if (heapUnpack(rope->flat) != NULL) {
+                printf("%s", LOAD_REF(ObjString, rope->flat)->chars);
+                break;
+            }
+            // This also gets called while tracing and logging the GC, so it must not allocate any objects
+            char* chars = (char*)malloc(rope->length);
+            if (chars == NULL) exit(1);
+            copyRope(rope, chars);
+            fwrite(chars, 1, rope->length, stdout);
+            free(chars);
+            break;
+        }
+        case OBJ_WEAK_REF: {
+            printf("<weak ref>");
+            break;
+        }
+        case OBJ_WEAK_MAP: {
+            printf("<weak map>");
             break;
         }
         default: return;
     }
 }
-
-ObjString* takeString(char* chars, int length) {
-    uint32_t hash = hashString(chars, length);
-    ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
-    }
-    return allocateString(chars, length, hash);
-}
\ No newline at end of file
@@ -11,15 +11,23 @@
 #include "common.h"
 #include "value.h"
 #include "chunk.h"
+#include "table.h"
+#include "ephemeron.h"
+#include "heap.h"
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->type)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
 #define IS_FUNCTION(value) isObjType(value, OBJ_FUNCTION)
 #define IS_NATIVE(value) isObjType(value, OBJ_NATIVE)
 #define IS_CLOSURE(value) isObjType(value, OBJ_CLOSURE)
-#define IS_CLASS(value) isObjType(value, OB_CLASS)
-#define IS_INSTANCE(value) isObjType(value, OBJ_CLASS)
+#define IS_CLASS(value) isObjType(value, OBJ_CLASS)
+#define IS_INSTANCE(value) isObjType(value, OBJ_INSTANCE)
 #define IS_BOUND(value) isObjType(value, OBJ_BOUND_METHOD)
+#define IS_ROPE(value) isObjType(value, OBJ_ROPE)
+#define IS_WEAK_REF(value) isObjType(value, OBJ_WEAK_REF)
+#define IS_WEAK_MAP(value) isObjType(value, OBJ_WEAK_MAP)
+// Either kind of Lox string, flat or not flattened yet
+#define IS_ANY_STRING(value) (IS_STRING(value) || IS_ROPE(value))
 
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
@@ -30,6 +38,11 @@
 #define AS_CLOSURE(value) ((ObjClosure*)AS_OBJ(value))
 #define AS_INSTANCE(value) ((ObjInstance*)AS_OBJ(value))
 #define AS_BOUND(value) ((ObjBoundMethod*)AS_OBJ(value))
+#define AS_ROPE(value) ((ObjRope*)AS_OBJ(value))
+#define AS_WEAK_REF(value) ((ObjWeakRef*)AS_OBJ(value))
+#define AS_WEAK_MAP(value) ((ObjWeakMap*)AS_OBJ(value))
+// Reads a field declared with HEAP_REF, see heap.h
+#define LOAD_REF(type, ref) ((type*)heapUnpack(ref))
 
 typedef enum {
     OBJ_STRING,
@@ -41,12 +54,16 @@ typedef enum {
     OBJ_UPVALUE,
     OBJ_CLASS,
     OBJ_BOUND_METHOD,
+    // A string made by concatenation, whose characters haven't been put together yet
+    OBJ_ROPE,
+    OBJ_WEAK_REF,
+    // Maps objects to values without keeping the objects alive
+    OBJ_WEAK_MAP,
 } ObjType;
 
+// Kept to a single word. Mark bits are not stored here, and the heap can find every object on its own, see heap.h
 struct Obj {
     ObjType type;
-    struct Obj* next;
-    bool isMarked;
 };
 
 // In lox, functions are first class.
@@ -55,8 +72,8 @@ typedef struct {
     // The number of parameters a function expects
     int arity;
     int upvalueCount;
+    HEAP_REF(ObjString) name;
     Chunk chunk;
-    ObjString* name;
 } ObjFunction;
 
 // We need these for native functions. Basically wrappers for native C code.
@@ -71,21 +88,45 @@ ObjNative* newNative(NativeFn native);
 
 ObjFunction* newFunction();
 
+// The characters are stored inline, right after the header, and are always NUL terminated
 struct ObjString {
     Obj obj;
     int length;
-    char* chars;
+    // Only computed once the string is interned
     uint32_t hash;
+    // Whether this is the one copy of these characters in vm.strings. Only interned strings can be table keys.
+    // Strings made at runtime skip all that until something needs it, and compare by their characters instead.
+    bool interned;
+    char chars[];
 };
 
+#define SIZEOF_STRING(length) (sizeof(ObjString) + (length) + 1)
+
+/**
+ * The result of concatenating two strings, where either half may itself be a rope. Building a string piece by piece
+ * this way is linear, instead of copying everything so far on each step. The characters are only put together when
+ * something needs them, after which the rope just stands in for that flat string.
+ */
+typedef struct {
+    Obj obj;
+    int length;
+    // Each an ObjString or an ObjRope, until flattening lets go of them
+    HEAP_REF(Obj) left;
+    HEAP_REF(Obj) right;
+    HEAP_REF(ObjString) flat;
+} ObjRope;
+
+// Concatenations shorter than this stay flat, as copying them is cheaper than keeping the pieces around
+#define ROPE_MIN_LENGTH 64
+
 // The runtime representation of an upvalue
 typedef struct ObjUpvalue {
     Obj obj;
+    // Each open upvalue points to the next open upvalue referencing a local var farther in the stack
+    HEAP_REF(struct ObjUpvalue) next;
     // Important that this is a pointer, as it needs to be aware of any changes to the variable that happen at runtime
     Value* location;
     Value closed;
-    // Each open upvalue points to the next open upvalue referencing a local var farther in the stack
-    struct ObjUpvalue* next;
 } ObjUpvalue;
 
 ObjUpvalue* newUpvalue(Value* slot);
@@ -93,17 +134,20 @@ ObjUpvalue* newUpvalue(Value* slot);
 // A struct that represents the closure for a given function
 typedef struct {
     Obj obj;
-    ObjFunction* function;
-    ObjUpvalue** upvalues;
     // More for the GC than anything else, because technically the function already knows their own upvalue count
     int upvalueCount;
+    HEAP_REF(ObjFunction) function;
+    // Stored inline, one for each of the function's upvalues
+    HEAP_REF(ObjUpvalue) upvalues[];
 } ObjClosure;
 
+#define SIZEOF_CLOSURE(upvalueCount) (sizeof(ObjClosure) + sizeof(HEAP_REF(ObjUpvalue)) * (upvalueCount))
+
 ObjClosure* newClosure(ObjFunction* function);
 
 typedef struct {
     Obj obj;
-    ObjString* name;
+    HEAP_REF(ObjString) name;
     Table methods;
 } ObjClass;
 
@@ -112,7 +156,7 @@ ObjClass* newClass(ObjString* name);
 // The runtime representation of an instance of a given class in Lox. 
 typedef struct {
     Obj obj;
-    ObjClass* klass;
+    HEAP_REF(ObjClass) klass;
     Table fields;
 } ObjInstance;
 
@@ -120,14 +164,43 @@ ObjInstance* newInstance(ObjClass* klass);
 
 typedef struct {
     Obj obj;
+    HEAP_REF(ObjClosure) method;
     Value receiver;
-    ObjClosure* method;
 } ObjBoundMethod;
 
 ObjBoundMethod* newBoundMethod(ObjClosure* method, Value receiver);
 
+// Refers to a value without keeping it alive. Once the GC collects it, the reference reads as nil.
+typedef struct ObjWeakRef {
+    Obj obj;
+    // Links the weak references the collection in progress has reached, so it can clear them once marking is done
+    HEAP_REF(struct ObjWeakRef) nextWeak;
+    Value target;
+} ObjWeakRef;
+
+ObjWeakRef* newWeakRef(Value target);
+
+typedef struct ObjWeakMap {
+    Obj obj;
+    // Same as ObjWeakRef's
+    HEAP_REF(struct ObjWeakMap) nextWeak;
+    EphemeronTable table;
+} ObjWeakMap;
+
+ObjWeakMap* newWeakMap();
+
+// Picks the per-process seed for string hashes, must run before the first string is made
+void seedStringHash();
+// The interned copy of these characters. This is where every table key comes from.
 ObjString* copyString(const char* chars, int length);
-ObjString* takeString(char* chars, int length);
+// For building a string in place: allocate it and fill in its characters. The string is never interned, so it has no
+// hash and must not be used as a table key; go through copyString() for that.
+ObjString* allocateString(int length);
+bool stringsEqual(ObjString* a, ObjString* b);
+// Both halves must be strings or ropes
+ObjRope* newRope(Obj* left, Obj* right, int length);
+// Puts the characters together the first time, and returns the same string every time after
+ObjString* flattenRope(ObjRope* rope);
 void printObject(Value value);
 
 // Cannot directly put this in the macro, as it will evaluate whatever "value" is multiple times.
@@ -135,6 +208,10 @@ static inline bool isObjType(Value value, ObjType type) {
     return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+static inline int stringLength(Value value) {
+    return IS_ROPE(value) ? AS_ROPE(value)->length : AS_STRING(value)->length;
+}
+
 
 
 #endif
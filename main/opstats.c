@@ -0,0 +1,311 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+#include "opstats.h"
+
+#ifdef DEBUG_OPCODE_STATS
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "vm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TICK_UNIT "cycles"
+
+static inline uint64_t readTicks() {
+    return __rdtsc();
+}
+#else
+#include <time.h>
+#define TICK_UNIT "ns"
+
+static inline uint64_t readTicks() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+#endif
+
+// An instruction counted since the last flush, by address. Only good until the next collection moves its function.
+typedef struct {
+    const uint8_t* ip;
+    ObjFunction* function;
+    uint64_t count;
+} LiveSite;
+
+// An instruction put down to where it is in the source, which outlives its function
+typedef struct {
+    char* function;
+    // Of the function's first instruction, to tell apart functions sharing a name
+    int firstLine;
+    int line;
+    int offset;
+    uint8_t instruction;
+    uint64_t count;
+} InstructionSite;
+
+typedef struct {
+    uint8_t first;
+    uint8_t second;
+    uint64_t count;
+} InstructionPair;
+
+static uint64_t counts[UINT8_COUNT];
+static uint64_t ticks[UINT8_COUNT];
+// How many runs of each opcode were timed, as the last one before the loop returns never is
+static uint64_t timed[UINT8_COUNT];
+// By the opcode that ran first, then the one right after it in the same frame
+static uint64_t pairs[UINT8_COUNT][UINT8_COUNT];
+
+// The instruction being timed, -1 for none
+static int previous = -1;
+static int previousDepth;
+static uint64_t previousStart;
+// What reading the counter twice in a row takes, which gets taken off every timed instruction
+static uint64_t timerOverhead = 0;
+static bool calibrated = false;
+
+// Open addressing by ip
+static LiveSite* liveSites = NULL;
+static int liveCount = 0;
+static int liveCapacity = 0;
+
+// Open addressing by function, line and offset
+static InstructionSite* sites = NULL;
+static int siteCount = 0;
+static int siteCapacity = 0;
+
+static void* checked(void* pointer) {
+    if (pointer == NULL) exit(1);
+    return pointer;
+}
+
+static int compareTicks(const void* a, const void* b) {
+    uint64_t left = *(const uint64_t*)a;
+    uint64_t right = *(const uint64_t*)b;
+    return left < right ? -1 : left > right;
+}
+
+static void calibrateTimer() {
+    // The median rather than the fastest, which under a hypervisor can be well below what a read usually takes
+    uint64_t samples[1001];
+    for (int i = 0; i < 1001; i++) {
+        uint64_t start = readTicks();
+        uint64_t end = readTicks();
+        samples[i] = end - start;
+    }
+    qsort(samples, 1001, sizeof(uint64_t), compareTicks);
+    timerOverhead = samples[500];
+    calibrated = true;
+}
+
+static uint32_t hashAddress(const uint8_t* ip) {
+    return (uint32_t)(((uint64_t)(uintptr_t)ip * 11400714819323198485u) >> 32);
+}
+
+static LiveSite* findLiveSite(LiveSite* entries, int capacity, const uint8_t* ip) {
+    uint32_t index = hashAddress(ip) & (capacity - 1);
+    while (entries[index].ip != NULL && entries[index].ip != ip) index = (index + 1) & (capacity - 1);
+    return &entries[index];
+}
+
+static void countSite(ObjFunction* function, const uint8_t* ip) {
+    if ((liveCount + 1) * 2 > liveCapacity) {
+        int capacity = liveCapacity == 0 ? 1024 : liveCapacity * 2;
+        LiveSite* entries = checked(calloc(capacity, sizeof(LiveSite)));
+        for (int i = 0; i < liveCapacity; i++) {
+            if (liveSites[i].ip != NULL) *findLiveSite(entries, capacity, liveSites[i].ip) = liveSites[i];
+        }
+        free(liveSites);
+        liveSites = entries;
+        liveCapacity = capacity;
+    }
+
+    LiveSite* site = findLiveSite(liveSites, liveCapacity, ip);
+    if (site->ip == NULL) {
+        site->ip = ip;
+        site->function = function;
+        liveCount++;
+    }
+    site->count++;
+}
+
+void countInstruction(ObjFunction* function, const uint8_t* ip) {
+    uint64_t now = readTicks();
+    uint8_t instruction = *ip;
+    if (previous >= 0) {
+        ticks[previous] += now - previousStart;
+        timed[previous]++;
+        // Nothing could fuse two instructions either side of a call or a return
+        if (vm.frameCount == previousDepth) pairs[previous][instruction]++;
+    }
+    counts[instruction]++;
+    countSite(function, ip);
+
+    previous = instruction;
+    previousDepth = vm.frameCount;
+    // Read last, so that the counting above isn't put down to the instruction
+    previousStart = readTicks();
+}
+
+void resetInstructionTimer() {
+    if (!calibrated) calibrateTimer();
+    previous = -1;
+}
+
+static uint64_t hashSite(const char* function, int firstLine, int offset) {
+    uint64_t hash = 14695981039346656037u;
+    for (const char* c = function; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 1099511628211u;
+    }
+    hash = (hash ^ (uint32_t)firstLine) * 1099511628211u;
+    return (hash ^ (uint32_t)offset) * 1099511628211u;
+}
+
+static InstructionSite* findSite(InstructionSite* entries, int capacity, const char* function, int firstLine,
+                                 int offset) {
+    uint64_t index = hashSite(function, firstLine, offset) & (capacity - 1);
+    while (entries[index].function != NULL) {
+        InstructionSite* site = &entries[index];
+        if (site->offset == offset && site->firstLine == firstLine && strcmp(site->function, function) == 0) break;
+        index = (index + 1) & (capacity - 1);
+    }
+    return &entries[index];
+}
+
+static void addSite(ObjFunction* function, const uint8_t* ip, uint64_t count) {
+    if ((siteCount + 1) * 2 > siteCapacity) {
+        int capacity = siteCapacity == 0 ? 256 : siteCapacity * 2;
+        InstructionSite* entries = checked(calloc(capacity, sizeof(InstructionSite)));
+        for (int i = 0; i < siteCapacity; i++) {
+            InstructionSite* site = &sites[i];
+            if (site->function == NULL) continue;
+            *findSite(entries, capacity, site->function, site->firstLine, site->offset) = *site;
+        }
+        free(sites);
+        sites = entries;
+        siteCapacity = capacity;
+    }
+
+    ObjString* name = LOAD_REF(ObjString, function->name);
+    const char* functionName = name == NULL ? "script" : name->chars;
+    int firstLine = getLine(&function->chunk, 0);
+    int offset = (int)(ip - function->chunk.code);
+    InstructionSite* site = findSite(sites, siteCapacity, functionName, firstLine, offset);
+    if (site->function == NULL) {
+        site->function = checked(strdup(functionName));
+        site->firstLine = firstLine;
+        site->line = getLine(&function->chunk, offset);
+        site->offset = offset;
+        site->instruction = *ip;
+        siteCount++;
+    }
+    site->count += count;
+}
+
+void flushInstructionSites() {
+    if (liveCount == 0) return;
+    for (int i = 0; i < liveCapacity; i++) {
+        LiveSite* site = &liveSites[i];
+        if (site->ip != NULL) addSite(site->function, site->ip, site->count);
+    }
+    memset(liveSites, 0, sizeof(LiveSite) * liveCapacity);
+    liveCount = 0;
+}
+
+static int compareOpcodes(const void* a, const void* b) {
+    uint64_t left = counts[*(const uint8_t*)a];
+    uint64_t right = counts[*(const uint8_t*)b];
+    if (left != right) return left < right ? 1 : -1;
+    return 0;
+}
+
+static int comparePairs(const void* a, const void* b) {
+    const InstructionPair* left = a;
+    const InstructionPair* right = b;
+    if (left->count != right->count) return left->count < right->count ? 1 : -1;
+    return 0;
+}
+
+static int compareSites(const void* a, const void* b) {
+    const InstructionSite* left = a;
+    const InstructionSite* right = b;
+    if (left->count != right->count) return left->count < right->count ? 1 : -1;
+    return 0;
+}
+
+static uint64_t timeOf(int instruction) {
+    uint64_t overhead = timed[instruction] * timerOverhead;
+    return ticks[instruction] > overhead ? ticks[instruction] - overhead : 0;
+}
+
+void printOpStats(FILE* out) {
+    flushInstructionSites();
+    uint64_t total = 0;
+    uint64_t totalTime = 0;
+    uint64_t totalTimed = 0;
+    uint8_t opcodes[UINT8_COUNT];
+    int opcodeCount = 0;
+    for (int i = 0; i < UINT8_COUNT; i++) {
+        if (counts[i] == 0) continue;
+        opcodes[opcodeCount++] = (uint8_t)i;
+        total += counts[i];
+        totalTime += timeOf(i);
+        totalTimed += timed[i];
+    }
+    fprintf(out, "Opcodes: %llu instructions run, %.1f %s each on average\n", (unsigned long long)total,
+            totalTimed == 0 ? 0.0 : (double)totalTime / totalTimed, TICK_UNIT);
+    if (total == 0) return;
+
+    qsort(opcodes, opcodeCount, sizeof(uint8_t), compareOpcodes);
+    fprintf(out, "  %12s %7s %10s %7s  %s\n", "count", "share", TICK_UNIT "/op", "time", "opcode");
+    for (int i = 0; i < opcodeCount; i++) {
+        int instruction = opcodes[i];
+        fprintf(out, "  %12llu %6.2f%% %10.1f %6.2f%%  %s\n", (unsigned long long)counts[instruction],
+                100.0 * counts[instruction] / total,
+                timed[instruction] == 0 ? 0.0 : (double)timeOf(instruction) / timed[instruction],
+                totalTime == 0 ? 0.0 : 100.0 * timeOf(instruction) / totalTime, opcodeName(instruction));
+    }
+
+    InstructionPair* pairList = checked(malloc(sizeof(InstructionPair) * opcodeCount * opcodeCount));
+    int pairCount = 0;
+    uint64_t pairTotal = 0;
+    for (int i = 0; i < opcodeCount; i++) {
+        for (int j = 0; j < opcodeCount; j++) {
+            uint64_t count = pairs[opcodes[i]][opcodes[j]];
+            if (count == 0) continue;
+            pairList[pairCount++] = (InstructionPair){opcodes[i], opcodes[j], count};
+            pairTotal += count;
+        }
+    }
+    qsort(pairList, pairCount, sizeof(InstructionPair), comparePairs);
+    fprintf(out, "Pairs run back to back in a frame:\n");
+    fprintf(out, "  %12s %7s  %s\n", "count", "share", "pair");
+    for (int i = 0; i < pairCount && i < OPSTATS_REPORT_ENTRIES; i++) {
+        InstructionPair* pair = &pairList[i];
+        fprintf(out, "  %12llu %6.2f%%  %s %s\n", (unsigned long long)pair->count, 100.0 * pair->count / pairTotal,
+                opcodeName(pair->first), opcodeName(pair->second));
+    }
+    free(pairList);
+
+    InstructionSite* siteList = checked(malloc(sizeof(InstructionSite) * (siteCount == 0 ? 1 : siteCount)));
+    int listed = 0;
+    for (int i = 0; i < siteCapacity; i++) {
+        if (sites[i].function != NULL) siteList[listed++] = sites[i];
+    }
+    qsort(siteList, listed, sizeof(InstructionSite), compareSites);
+    fprintf(out, "Sites:\n");
+    fprintf(out, "  %12s %7s  %s\n", "count", "share", "site");
+    for (int i = 0; i < listed && i < OPSTATS_REPORT_ENTRIES; i++) {
+        InstructionSite* site = &siteList[i];
+        fprintf(out, "  %12llu %6.2f%%  %s:%d @%04d %s\n", (unsigned long long)site->count,
+                100.0 * site->count / total, site->function, site->line, site->offset, opcodeName(site->instruction));
+    }
+    free(siteList);
+}
+
+#endif
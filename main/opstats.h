@@ -0,0 +1,40 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * Opcode statistics, for builds with DEBUG_OPCODE_STATS defined. Every instruction run() dispatches is counted by
+ * opcode, by the opcode that ran right before it in the same frame, and by where it sits in its function. Each
+ * opcode also gets the time from its dispatch to the next one, read off the time stamp counter where there is one,
+ * which makes for a rough cycles per instruction figure. The counter ticks at the CPU's nominal frequency, so those
+ * are reference cycles, and they include the cost of any collection the instruction triggered. The counting itself
+ * crowds the caches and keeps the branch predictor from learning the dispatch, so the figures run well above what an
+ * uninstrumented build takes; they are for comparing opcodes against each other.
+ *
+ * Without DEBUG_OPCODE_STATS none of this is compiled, and run() has no trace of it.
+ */
+#ifndef clox_opstats_h
+#define clox_opstats_h
+
+#include "common.h"
+
+#ifdef DEBUG_OPCODE_STATS
+
+#include <stdio.h>
+
+#include "object.h"
+
+// How many of the most frequent pairs and sites the report lists
+#define OPSTATS_REPORT_ENTRIES 20
+
+// Counts the instruction at ip, which belongs to function, just before it is dispatched
+void countInstruction(ObjFunction* function, const uint8_t* ip);
+// Forgets the instruction being timed, so whatever ran since the interpreter loop last left isn't put down to it
+void resetInstructionTimer();
+// Puts the sites counted so far down to function names and lines, while those functions are still where they were
+void flushInstructionSites();
+void printOpStats(FILE* out);
+
+#endif
+
+#endif
@@ -0,0 +1,368 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+#include "profiler.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "object.h"
+#include "vm.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PROFILER_USE_SIGNAL
+#include <sys/time.h>
+#endif
+
+// Stands in for the depth in the header of a sample taken during a collection
+#define PROFILE_IN_GC (-1)
+
+/*
+ * Each sample takes up a header, with a NULL function and the number of frames following it as the offset, then one
+ * entry per frame, outermost first.
+ */
+typedef struct {
+    ObjFunction* function;
+    // Of the instruction the frame is at
+    int offset;
+} ProfileEntry;
+
+// A function name and line, the unit samples get put down to
+typedef struct {
+    char* name;
+    // -1 for the pseudo frames that have no line
+    int line;
+    // Frames of the same function share this
+    int function;
+} ProfileFrame;
+
+typedef struct {
+    uint64_t hash;
+    int* frames;
+    int depth;
+    uint64_t samples;
+} ProfileStack;
+
+typedef struct {
+    bool running;
+    int rate;
+    // CPU time over which the profiler ran, as the kernel may not deliver samples as often as asked
+    clock_t started;
+    clock_t stopped;
+    uint64_t samples;
+    uint64_t dropped;
+
+    ProfileFrame* frames;
+    int frameCount;
+    int frameCapacity;
+    // Open addressing over frames, -1 for empty
+    int* frameIndex;
+    int frameIndexCapacity;
+    // The names of the functions the frames belong to
+    char** functions;
+    int functionCount;
+    int functionCapacity;
+
+    // Open addressing by hash
+    ProfileStack* stacks;
+    int stackCount;
+    int stackCapacity;
+} Profile;
+
+volatile sig_atomic_t profileDrainRequested = 0;
+
+static ProfileEntry ring[PROFILE_RING_SIZE];
+// Both only ever go up; the ring holds the entries in [ringTail, ringHead)
+static _Atomic uint64_t ringHead = 0;
+static _Atomic uint64_t ringTail = 0;
+static Profile profile;
+
+static void* checked(void* pointer) {
+    if (pointer == NULL) exit(1);
+    return pointer;
+}
+
+#ifdef PROFILER_USE_SIGNAL
+static void takeSample(int signalNumber) {
+    uint64_t head = atomic_load_explicit(&ringHead, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ringTail, memory_order_acquire);
+    // Objects may be halfway through moving during a collection, so there's no following the frames then
+    bool collecting = vm.collecting;
+    int depth = collecting ? 0 : vm.frameCount;
+    if (head - tail + depth + 1 > PROFILE_RING_SIZE) {
+        profile.dropped++;
+        profileDrainRequested = 1;
+        return;
+    }
+
+    ring[head % PROFILE_RING_SIZE] = (ProfileEntry){NULL, collecting ? PROFILE_IN_GC : depth};
+    for (int i = 0; i < depth; i++) {
+        CallFrame* frame = &vm.frames[i];
+        ObjFunction* function = LOAD_REF(ObjFunction, frame->closure->function);
+        // ip has already moved past the instruction that is running
+        ring[(head + 1 + i) % PROFILE_RING_SIZE] = (ProfileEntry){function, (int)(frame->ip - function->chunk.code - 1)};
+    }
+    atomic_store_explicit(&ringHead, head + depth + 1, memory_order_release);
+    if (head + depth + 1 - tail > PROFILE_RING_SIZE / 2) profileDrainRequested = 1;
+}
+#endif
+
+bool startProfiler(int rate) {
+#ifdef PROFILER_USE_SIGNAL
+    if (rate <= 0 || rate > 1000000) return false;
+    memset(&profile, 0, sizeof(Profile));
+    profile.rate = rate;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = takeSample;
+    // Reads of the script or the REPL's input shouldn't fail just because a sample was taken in the middle of them
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, NULL) != 0) return false;
+
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = 1000000 / rate;
+    timer.it_value = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) return false;
+    profile.started = clock();
+    profile.running = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void stopProfiler() {
+    if (!profile.running) return;
+#ifdef PROFILER_USE_SIGNAL
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+#endif
+    drainProfile();
+    profile.stopped = clock();
+    profile.running = false;
+}
+
+static uint64_t hashName(const char* name, int line) {
+    uint64_t hash = 14695981039346656037u;
+    for (const char* c = name; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 1099511628211u;
+    }
+    return (hash ^ (uint32_t)line) * 1099511628211u;
+}
+
+static int internFunction(const char* name) {
+    for (int i = profile.functionCount - 1; i >= 0; i--) {
+        if (strcmp(profile.functions[i], name) == 0) return i;
+    }
+    if (profile.functionCount == profile.functionCapacity) {
+        profile.functionCapacity = profile.functionCapacity < 8 ? 8 : profile.functionCapacity * 2;
+        profile.functions = checked(realloc(profile.functions, sizeof(char*) * profile.functionCapacity));
+    }
+    profile.functions[profile.functionCount] = checked(strdup(name));
+    return profile.functionCount++;
+}
+
+static void indexFrame(int frame) {
+    uint64_t slot = hashName(profile.frames[frame].name, profile.frames[frame].line)
+                    & (profile.frameIndexCapacity - 1);
+    while (profile.frameIndex[slot] != -1) slot = (slot + 1) & (profile.frameIndexCapacity - 1);
+    profile.frameIndex[slot] = frame;
+}
+
+static int internFrame(const char* name, int line) {
+    if (profile.frameIndexCapacity == 0) {
+        profile.frameIndexCapacity = 64;
+        profile.frameIndex = checked(malloc(sizeof(int) * profile.frameIndexCapacity));
+        memset(profile.frameIndex, -1, sizeof(int) * profile.frameIndexCapacity);
+    }
+    uint64_t slot = hashName(name, line) & (profile.frameIndexCapacity - 1);
+    while (profile.frameIndex[slot] != -1) {
+        ProfileFrame* frame = &profile.frames[profile.frameIndex[slot]];
+        if (frame->line == line && strcmp(frame->name, name) == 0) return profile.frameIndex[slot];
+        slot = (slot + 1) & (profile.frameIndexCapacity - 1);
+    }
+
+    if (profile.frameCount == profile.frameCapacity) {
+        profile.frameCapacity = profile.frameCapacity < 8 ? 8 : profile.frameCapacity * 2;
+        profile.frames = checked(realloc(profile.frames, sizeof(ProfileFrame) * profile.frameCapacity));
+    }
+    int index = profile.frameCount++;
+    profile.frames[index] = (ProfileFrame){checked(strdup(name)), line, internFunction(name)};
+    // Kept at most half full
+    if (profile.frameCount * 2 > profile.frameIndexCapacity) {
+        profile.frameIndexCapacity *= 2;
+        profile.frameIndex = checked(realloc(profile.frameIndex, sizeof(int) * profile.frameIndexCapacity));
+        memset(profile.frameIndex, -1, sizeof(int) * profile.frameIndexCapacity);
+        for (int i = 0; i < profile.frameCount; i++) indexFrame(i);
+    } else {
+        profile.frameIndex[slot] = index;
+    }
+    return index;
+}
+
+static ProfileStack* findStack(ProfileStack* stacks, int capacity, uint64_t hash, const int* frames, int depth) {
+    uint64_t index = hash & (capacity - 1);
+    while (stacks[index].frames != NULL) {
+        ProfileStack* stack = &stacks[index];
+        if (stack->hash == hash && stack->depth == depth && memcmp(stack->frames, frames, sizeof(int) * depth) == 0) {
+            break;
+        }
+        index = (index + 1) & (capacity - 1);
+    }
+    return &stacks[index];
+}
+
+static void addStack(const int* frames, int depth) {
+    if ((profile.stackCount + 1) * 2 > profile.stackCapacity) {
+        int capacity = profile.stackCapacity == 0 ? 64 : profile.stackCapacity * 2;
+        ProfileStack* stacks = checked(calloc(capacity, sizeof(ProfileStack)));
+        for (int i = 0; i < profile.stackCapacity; i++) {
+            ProfileStack* stack = &profile.stacks[i];
+            if (stack->frames == NULL) continue;
+            *findStack(stacks, capacity, stack->hash, stack->frames, stack->depth) = *stack;
+        }
+        free(profile.stacks);
+        profile.stacks = stacks;
+        profile.stackCapacity = capacity;
+    }
+
+    uint64_t hash = 14695981039346656037u;
+    for (int i = 0; i < depth; i++) hash = (hash ^ (uint32_t)frames[i]) * 1099511628211u;
+    ProfileStack* stack = findStack(profile.stacks, profile.stackCapacity, hash, frames, depth);
+    if (stack->frames == NULL) {
+        stack->hash = hash;
+        stack->frames = checked(malloc(sizeof(int) * depth));
+        memcpy(stack->frames, frames, sizeof(int) * depth);
+        stack->depth = depth;
+        profile.stackCount++;
+    }
+    stack->samples++;
+    profile.samples++;
+}
+
+void drainProfile() {
+    profileDrainRequested = 0;
+    uint64_t tail = atomic_load_explicit(&ringTail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ringHead, memory_order_acquire);
+    if (tail == head) return;
+    while (tail < head) {
+        ProfileEntry header = ring[tail % PROFILE_RING_SIZE];
+        int frames[FRAMES_MAX];
+        int depth = 0;
+        if (header.offset == PROFILE_IN_GC) {
+            frames[depth++] = internFrame("(gc)", -1);
+            tail++;
+        } else if (header.offset == 0) {
+            frames[depth++] = internFrame("(compile)", -1);
+            tail++;
+        } else {
+            for (int i = 0; i < header.offset; i++) {
+                ProfileEntry entry = ring[(tail + 1 + i) % PROFILE_RING_SIZE];
+                ObjString* name = LOAD_REF(ObjString, entry.function->name);
+                frames[depth++] = internFrame(name == NULL ? "script" : name->chars,
+                                              getLine(&entry.function->chunk, entry.offset));
+            }
+            tail += 1 + header.offset;
+        }
+        addStack(frames, depth);
+    }
+    atomic_store_explicit(&ringTail, tail, memory_order_release);
+}
+
+static void writeFrame(FILE* out, ProfileFrame* frame) {
+    if (frame->line < 0) {
+        fputs(frame->name, out);
+    } else {
+        fprintf(out, "%s:%d", frame->name, frame->line);
+    }
+}
+
+void writeProfileStacks(FILE* out) {
+    for (int i = 0; i < profile.stackCapacity; i++) {
+        ProfileStack* stack = &profile.stacks[i];
+        if (stack->frames == NULL) continue;
+        for (int j = 0; j < stack->depth; j++) {
+            if (j > 0) fputc(';', out);
+            writeFrame(out, &profile.frames[stack->frames[j]]);
+        }
+        fprintf(out, " %llu\n", (unsigned long long)stack->samples);
+    }
+}
+
+typedef struct {
+    int id;
+    uint64_t self;
+    uint64_t total;
+    // The last stack this was counted in, so that recursion doesn't count it twice towards total
+    int lastStack;
+} ProfileTally;
+
+static int compareTallies(const void* a, const void* b) {
+    const ProfileTally* left = a;
+    const ProfileTally* right = b;
+    if (left->self != right->self) return left->self < right->self ? 1 : -1;
+    if (left->total != right->total) return left->total < right->total ? 1 : -1;
+    return 0;
+}
+
+static void printTallies(FILE* out, ProfileTally* tallies, int count, bool byLine) {
+    qsort(tallies, count, sizeof(ProfileTally), compareTallies);
+    fprintf(out, "  %7s %7s %9s  %s\n", "self", "total", "samples", byLine ? "line" : "function");
+    for (int i = 0; i < count && i < PROFILE_REPORT_ENTRIES; i++) {
+        ProfileTally* tally = &tallies[i];
+        fprintf(out, "  %6.1f%% %6.1f%% %9llu  ", 100.0 * tally->self / profile.samples,
+                100.0 * tally->total / profile.samples, (unsigned long long)tally->self);
+        if (byLine) {
+            writeFrame(out, &profile.frames[tally->id]);
+        } else {
+            fputs(profile.functions[tally->id], out);
+        }
+        fputc('\n', out);
+    }
+}
+
+void printProfileReport(FILE* out) {
+    fprintf(out, "Profile: %llu samples over %.2f s of CPU time, at %d Hz", (unsigned long long)profile.samples,
+            (double)(profile.stopped - profile.started) / CLOCKS_PER_SEC, profile.rate);
+    if (profile.dropped > 0) fprintf(out, ", %llu dropped", (unsigned long long)profile.dropped);
+    fputc('\n', out);
+    if (profile.samples == 0) return;
+
+    ProfileTally* lines = checked(calloc(profile.frameCount, sizeof(ProfileTally)));
+    ProfileTally* functions = checked(calloc(profile.functionCount, sizeof(ProfileTally)));
+    for (int i = 0; i < profile.frameCount; i++) lines[i] = (ProfileTally){i, 0, 0, -1};
+    for (int i = 0; i < profile.functionCount; i++) functions[i] = (ProfileTally){i, 0, 0, -1};
+    for (int i = 0; i < profile.stackCapacity; i++) {
+        ProfileStack* stack = &profile.stacks[i];
+        if (stack->frames == NULL) continue;
+        for (int j = 0; j < stack->depth; j++) {
+            ProfileTally* line = &lines[stack->frames[j]];
+            ProfileTally* function = &functions[profile.frames[stack->frames[j]].function];
+            if (line->lastStack != i) {
+                line->total += stack->samples;
+                line->lastStack = i;
+            }
+            if (function->lastStack != i) {
+                function->total += stack->samples;
+                function->lastStack = i;
+            }
+        }
+        int leaf = stack->frames[stack->depth - 1];
+        lines[leaf].self += stack->samples;
+        functions[profile.frames[leaf].function].self += stack->samples;
+    }
+
+    fprintf(out, "By function:\n");
+    printTallies(out, functions, profile.functionCount, false);
+    fprintf(out, "By line:\n");
+    printTallies(out, lines, profile.frameCount, true);
+    free(lines);
+    free(functions);
+}
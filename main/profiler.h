@@ -0,0 +1,45 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * A sampling profiler. SIGPROF goes off every so often while the process is using CPU, and each time the handler
+ * copies the Lox call stack, as the function and instruction of every frame, into a ring buffer. Nothing in the
+ * handler allocates or takes a lock: it is the only writer of the ring and the VM the only reader, so publishing a
+ * sample is just moving the ring's head along.
+ *
+ * The VM drains the ring, turning each sample into function names and lines, whenever it fills past half way, and
+ * before every collection, as that is when the functions a sample points at could move or be freed. Samples taken
+ * during a collection are put down to "(gc)", and those taken while no script is running to "(compile)".
+ *
+ * Once stopped, the profiler can report the functions and lines that took the most samples, both by themselves
+ * (self) and counting what they called (total), and write collapsed stacks for flamegraph tooling, one
+ * "frame;frame;frame samples" line per distinct stack.
+ */
+#ifndef clox_profiler_h
+#define clox_profiler_h
+
+#include <signal.h>
+#include <stdio.h>
+
+#include "common.h"
+
+// Samples the ring can hold, counting each frame of a sample and the header before them
+#define PROFILE_RING_SIZE (1 << 16)
+#define PROFILE_DEFAULT_RATE 1000
+// How many functions and lines the report lists
+#define PROFILE_REPORT_ENTRIES 20
+
+// Set by the signal handler once the ring is getting full, and answered at the VM's next safepoint
+extern volatile sig_atomic_t profileDrainRequested;
+
+// Starts sampling 'rate' times per second of CPU time. Returns false if the platform can't.
+bool startProfiler(int rate);
+// Stops sampling and drains what is left in the ring. Does nothing if the profiler isn't running.
+void stopProfiler();
+// Turns the samples in the ring into stacks of function names and lines
+void drainProfile();
+void printProfileReport(FILE* out);
+void writeProfileStacks(FILE* out);
+
+#endif
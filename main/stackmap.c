@@ -0,0 +1,263 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+#include "stackmap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+
+typedef struct {
+    int offset;
+    // -1 if the instruction doesn't touch a local
+    int use;
+    int def;
+    // Instruction indices of where control may go next, -1 for none
+    int next[2];
+    // Whether the GC may run while the instruction does
+    bool collects;
+} Instruction;
+
+// Slot sets are bitmaps, one bit per local slot
+static inline void addSlot(uint64_t* set, int slot) {
+    set[slot / 64] |= (uint64_t)1 << (slot % 64);
+}
+
+void initStackMap(StackMap* stackMap) {
+    stackMap->count = 0;
+    stackMap->capacity = 0;
+    stackMap->entries = NULL;
+    stackMap->slotCount = 0;
+    stackMap->slotCapacity = 0;
+    stackMap->deadSlots = NULL;
+}
+
+void freeStackMap(StackMap* stackMap) {
+    FREE_ARRAY(StackMapEntry, stackMap->entries, stackMap->capacity);
+    FREE_ARRAY(uint8_t, stackMap->deadSlots, stackMap->slotCapacity);
+    initStackMap(stackMap);
+}
+
+static int instructionLength(Chunk* chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_CLASS:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_CALL:
+        case OP_METHOD:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_INVOKE:
+            return 3;
+        case OP_CLOSURE: {
+            ObjFunction* function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + 2 * function->upvalueCount;
+        }
+        default:
+            return 1;
+    }
+}
+
+// Whether the instruction can allocate, or is a safepoint that may compact
+static bool mayCollect(uint8_t instruction) {
+    switch (instruction) {
+        case OP_ADD:
+        case OP_EQUAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_CALL:
+        case OP_INVOKE:
+        case OP_CLOSURE:
+        case OP_CLASS:
+        case OP_METHOD:
+        case OP_LOOP:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void addEntry(StackMap* stackMap, int start, int end, const uint8_t* slots, int slotCount) {
+    if (stackMap->slotCapacity < stackMap->slotCount + slotCount) {
+        int oldCapacity = stackMap->slotCapacity;
+        while (stackMap->slotCapacity < stackMap->slotCount + slotCount) {
+            stackMap->slotCapacity = GROW_CAPACITY(stackMap->slotCapacity);
+        }
+        stackMap->deadSlots = GROW_ARRAY(uint8_t, stackMap->deadSlots, oldCapacity, stackMap->slotCapacity);
+    }
+    if (stackMap->capacity < stackMap->count + 1) {
+        int oldCapacity = stackMap->capacity;
+        stackMap->capacity = GROW_CAPACITY(oldCapacity);
+        stackMap->entries = GROW_ARRAY(StackMapEntry, stackMap->entries, oldCapacity, stackMap->capacity);
+    }
+
+    StackMapEntry* entry = &stackMap->entries[stackMap->count++];
+    entry->start = start;
+    entry->end = end;
+    entry->deadStart = stackMap->slotCount;
+    entry->deadCount = slotCount;
+    memcpy(stackMap->deadSlots + stackMap->slotCount, slots, slotCount);
+    stackMap->slotCount += slotCount;
+}
+
+void buildStackMap(Chunk* chunk, LocalRange* locals, int localCount) {
+    if (localCount == 0 || chunk->count == 0) return;
+
+    // Decode the code into instructions, and find which instruction each jump lands on
+    Instruction* code = malloc(sizeof(Instruction) * chunk->count);
+    int* indexAt = malloc(sizeof(int) * (chunk->count + 1));
+    if (code == NULL || indexAt == NULL) exit(1);
+    uint64_t captured[UINT8_COUNT / 64] = {0};
+    bool hasLoop = false;
+    int count = 0;
+    for (int offset = 0; offset < chunk->count; count++) {
+        indexAt[offset] = count;
+        code[count].offset = offset;
+        offset += instructionLength(chunk, offset);
+    }
+    indexAt[chunk->count] = count;
+
+    for (int i = 0; i < count; i++) {
+        Instruction* instruction = &code[i];
+        uint8_t* bytes = &chunk->code[instruction->offset];
+        int end = i + 1 < count ? code[i + 1].offset : chunk->count;
+        instruction->use = -1;
+        instruction->def = -1;
+        instruction->next[0] = i + 1 < count ? i + 1 : -1;
+        instruction->next[1] = -1;
+        instruction->collects = mayCollect(bytes[0]);
+        switch (bytes[0]) {
+            case OP_GET_LOCAL: instruction->use = bytes[1]; break;
+            case OP_SET_LOCAL: instruction->def = bytes[1]; break;
+            case OP_JUMP:
+                instruction->next[0] = indexAt[end + (uint16_t)(bytes[1] << 8 | bytes[2])];
+                break;
+            case OP_JUMP_IF_FALSE:
+                instruction->next[1] = indexAt[end + (uint16_t)(bytes[1] << 8 | bytes[2])];
+                break;
+            case OP_LOOP:
+                hasLoop = true;
+                instruction->next[0] = indexAt[end - (uint16_t)(bytes[1] << 8 | bytes[2])];
+                break;
+            case OP_RETURN:
+                instruction->next[0] = -1;
+                break;
+            case OP_CLOSURE:
+                // Whatever a closure captures can be read through its upvalue at any time
+                for (int j = 2; j < end - instruction->offset; j += 2) {
+                    if (bytes[j]) addSlot(captured, bytes[j + 1]);
+                }
+                break;
+        }
+    }
+
+    // Slot sets take up as many words as the highest slot needs, which for most functions is just the one
+    int words = 1;
+    for (int i = 0; i < localCount; i++) {
+        if (locals[i].slot / 64 + 1 > words) words = locals[i].slot / 64 + 1;
+    }
+
+    // A local starts out holding the value its initializer left on the stack, so slots are also defined where a
+    // local comes into scope. Whatever was in the slot before that is dead from there on. That only goes for the code
+    // leading up to the local, a loop jumping back to where it starts is still inside its scope.
+    uint64_t* born = calloc((size_t)(count + 1) * words, sizeof(uint64_t));
+    uint64_t* ended = calloc((size_t)(count + 1) * words, sizeof(uint64_t));
+    uint64_t* liveIn = calloc((size_t)(count + 1) * words, sizeof(uint64_t));
+    if (born == NULL || ended == NULL || liveIn == NULL) exit(1);
+    for (int i = 0; i < localCount; i++) {
+        // Like a block holding a single unused variable, which goes out of scope as soon as it is defined
+        if (locals[i].start >= locals[i].end) continue;
+        addSlot(&born[indexAt[locals[i].start] * words], locals[i].slot);
+        addSlot(&ended[indexAt[locals[i].end] * words], locals[i].slot);
+    }
+
+    // Backward liveness, to a fixed point. Each pass runs the code back to front, so without any loops one pass is
+    // all it takes.
+    bool changed = true;
+    for (bool first = true; changed && (first || hasLoop); first = false) {
+        changed = false;
+        for (int i = count - 1; i >= 0; i--) {
+            Instruction* instruction = &code[i];
+            uint64_t in[UINT8_COUNT / 64] = {0};
+            for (int j = 0; j < 2; j++) {
+                int next = instruction->next[j];
+                if (next < 0) continue;
+                for (int w = 0; w < words; w++) {
+                    in[w] |= liveIn[next * words + w] & (next > i ? ~born[next * words + w] : ~(uint64_t)0);
+                }
+            }
+            if (instruction->def >= 0) in[instruction->def / 64] &= ~((uint64_t)1 << (instruction->def % 64));
+            if (instruction->use >= 0) addSlot(in, instruction->use);
+
+            for (int w = 0; w < words; w++) {
+                if (liveIn[i * words + w] != in[w]) {
+                    liveIn[i * words + w] = in[w];
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    // Walking forward keeps track of which slots hold a local. Entries go in by offset, which is what
+    // findStackMapEntry() relies on.
+    uint64_t inScope[UINT8_COUNT / 64] = {0};
+    for (int i = 0; i < count; i++) {
+        Instruction* instruction = &code[i];
+        for (int w = 0; w < words; w++) {
+            inScope[w] = (inScope[w] & ~ended[i * words + w]) | born[i * words + w];
+        }
+        // None of the instructions that collect touch a local, so what is live going into one is live after it too
+        if (!instruction->collects) continue;
+        uint8_t dead[UINT8_COUNT];
+        int deadCount = 0;
+        for (int w = 0; w < words; w++) {
+            uint64_t bits = inScope[w] & ~liveIn[i * words + w] & ~captured[w];
+            while (bits != 0) {
+                dead[deadCount++] = (uint8_t)(w * 64 + __builtin_ctzll(bits));
+                bits &= bits - 1;
+            }
+        }
+        if (deadCount == 0) continue;
+        int end = i + 1 < count ? code[i + 1].offset : chunk->count;
+        addEntry(&chunk->stackMap, instruction->offset, end, dead, deadCount);
+    }
+
+    free(code);
+    free(indexAt);
+    free(born);
+    free(ended);
+    free(liveIn);
+}
+
+StackMapEntry* findStackMapEntry(StackMap* stackMap, int ipOffset) {
+    // Binary search for the last entry starting before ipOffset, then check ipOffset is inside it
+    int low = 0;
+    int high = stackMap->count - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        StackMapEntry* entry = &stackMap->entries[mid];
+        if (entry->start >= ipOffset) {
+            high = mid - 1;
+        } else if (entry->end < ipOffset) {
+            low = mid + 1;
+        } else {
+            return entry;
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,32 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * Stack maps let the GC tell which of a frame's locals the rest of its function will still read. Once its code is
+ * compiled, every function gets a liveness analysis over its bytecode, and for each instruction that may collect,
+ * the chunk records the locals that are in scope there but dead: never read again before being overwritten or going
+ * out of scope. Those slots get wiped before the stack is marked, so a local holding on to a big structure it is done
+ * with doesn't keep that structure alive until the end of its block.
+ *
+ * An instruction without an entry has nothing to wipe, which also makes it safe to leave any instruction out.
+ */
+#ifndef clox_stackmap_h
+#define clox_stackmap_h
+
+#include "chunk.h"
+
+// The code a local is in scope for, [start, end)
+typedef struct {
+    int slot;
+    int start;
+    int end;
+} LocalRange;
+
+void initStackMap(StackMap* stackMap);
+void freeStackMap(StackMap* stackMap);
+// Works out the dead locals of every instruction in the chunk that may collect, given where each local was in scope
+void buildStackMap(Chunk* chunk, LocalRange* locals, int localCount);
+// The entry for the instruction running with its ip at 'ipOffset', which is somewhere past the opcode. NULL if none.
+StackMapEntry* findStackMapEntry(StackMap* stackMap, int ipOffset);
+#endif
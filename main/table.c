@@ -6,10 +6,108 @@
 
 #include <string.h>
 
+#include "heap.h"
 #include "memory.h"
 #include "object.h"
 
-#define TABLE_MAX_LOAD 0.75
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TABLE_MAX_LOAD 0.875
+#define TABLE_MIN_CAPACITY 8
+// Past this share of tombstones, tableTrim() rehashes them away
+#define TABLE_MAX_TOMBSTONES 0.125
+// Below this share of live entries, tableTrim() shrinks the table down to about half full
+#define TABLE_MIN_LOAD 0.125
+#define TABLE_SHRUNK_LOAD 0.5
+// How many slots ahead markTable() prefetches, same as the GC's own prefetch distance
+#define TABLE_PREFETCH_DISTANCE 8
+
+/*
+ * Tables are laid out like a Swiss table: next to the entries sits an array of control bytes, one per slot, and
+ * lookups scan those a whole group at a time instead of touching the entries. A full slot's control byte holds the
+ * low 7 bits of its key's hash, so most slots that can't hold the key get ruled out without ever loading it.
+ * The rest of the hash picks the group a probe starts from.
+ *
+ * Until it holds more than TABLE_INLINE_CAPACITY entries a table doesn't use any of that: its entries sit packed at
+ * the front of inlineEntries, and lookups just compare keys one after the other.
+ */
+#define GROUP_SIZE 16
+#define CONTROL_EMPTY ((uint8_t)0x80)
+#define CONTROL_DELETED ((uint8_t)0xFE)
+#define HASH_GROUP(hash) ((hash) >> 7)
+#define HASH_TAG(hash) ((uint8_t)((hash) & 0x7F))
+
+// A table smaller than a group still gets a whole group's worth of control bytes, the extra ones are always empty.
+// One without any slots has never allocated anything at all.
+#define CONTROL_BYTES(capacity) ((capacity) == 0 ? 0 : (capacity) < GROUP_SIZE ? GROUP_SIZE : (capacity))
+#define TABLE_BYTES(capacity) (sizeof(Entry) * (capacity) + CONTROL_BYTES(capacity))
+
+// One bit for each slot of a group
+typedef uint32_t GroupMask;
+
+static inline uint8_t* controlBytes(Table* table) {
+    return (uint8_t*)(table->entries + table->capacity);
+}
+
+static inline GroupMask matchTag(const uint8_t* group, uint8_t tag) {
+#ifdef __SSE2__
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8((char)tag)));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) {
+        if (group[i] == tag) mask |= (GroupMask)1 << i;
+    }
+    return mask;
+#endif
+}
+
+// Empty and deleted slots are the only ones with their high bit set
+static inline GroupMask matchFree(const uint8_t* group) {
+#ifdef __SSE2__
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_SIZE; i++) {
+        if (group[i] & 0x80) mask |= (GroupMask)1 << i;
+    }
+    return mask;
+#endif
+}
+
+static inline GroupMask matchEmpty(const uint8_t* group) {
+    return matchTag(group, CONTROL_EMPTY);
+}
+
+static inline int groupCount(int capacity) {
+    return capacity < GROUP_SIZE ? 1 : capacity / GROUP_SIZE;
+}
+
+// Groups are visited in triangular steps, which reaches every one of them since there is a power of two of them.
+// The probe only ends at a group with an empty slot, and the load factor makes sure there always is one.
+#define FOR_EACH_GROUP(table, hash, group) \
+    for (uint32_t mask_ = groupCount((table)->capacity) - 1, group = HASH_GROUP(hash) & mask_, step_ = 1; ; \
+         group = (group + step_++) & mask_)
+
+// Every slot a walk over the whole table has to look at. Hashed slots that aren't in use have a NULL key.
+static inline Entry* allEntries(Table* table, int* slotCount) {
+    if (table->capacity == 0) {
+        *slotCount = table->count;
+        return table->inlineEntries;
+    }
+    *slotCount = table->capacity;
+    return table->entries;
+}
+
+// The index of 'key' in an inline table, or -1 if it isn't there
+static inline int findInline(Table* table, ObjString* key) {
+    for (int i = 0; i < table->count; i++) {
+        if (table->inlineEntries[i].key == key) return i;
+    }
+    return -1;
+}
 
 void initTable(Table* table) {
     table->count = 0;
@@ -19,73 +117,110 @@ void initTable(Table* table) {
 
 void freeTable(Table* table) {
     // free_array already null checks for us
-    FREE_ARRAY(Entry, table->entries, table->capacity);
+    FREE_ARRAY(uint8_t, table->entries, TABLE_BYTES(table->capacity));
     initTable(table);
 }
 
-static Entry* findEntry(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash % capacity;
-    Entry* tombstone = NULL;
-    for (;;) {
-        Entry* entry = &entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // Empty entry
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // indicates we found a tombstone
-                if (tombstone == NULL) tombstone = entry;
-            }
-        } else if (entry->key == key) {
-            return entry;
+// The slot holding 'key' in a hashed table, or -1 if it isn't in the table
+static inline int findSlot(Table* table, ObjString* key) {
+    uint8_t* control = controlBytes(table);
+    uint8_t tag = HASH_TAG(key->hash);
+
+    FOR_EACH_GROUP(table, key->hash, group) {
+        int base = (int)group * GROUP_SIZE;
+        GroupMask matches = matchTag(control + base, tag);
+        while (matches != 0) {
+            int slot = base + __builtin_ctz(matches);
+            if (table->entries[slot].key == key) return slot;
+            matches &= matches - 1;
         }
+        if (matchEmpty(control + base) != 0) return -1;
+    }
+}
 
-        index = (index + 1) % capacity;
+// The first empty or deleted slot on the probe sequence for 'hash'
+static int findFreeSlot(Table* table, uint32_t hash) {
+    uint8_t* control = controlBytes(table);
+    // The padding past the end of a small table looks empty, but isn't a real slot
+    GroupMask slots = table->capacity < GROUP_SIZE ? ((GroupMask)1 << table->capacity) - 1 : 0xFFFF;
+
+    FOR_EACH_GROUP(table, hash, group) {
+        int base = (int)group * GROUP_SIZE;
+        GroupMask free = matchFree(control + base) & slots;
+        if (free != 0) return base + __builtin_ctz(free);
     }
 }
 
 static void adjustCapacity(Table* table, int capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity);
+    Table resized;
+    resized.count = 0;
+    resized.capacity = capacity;
+    resized.entries = (Entry*)ALLOCATE(uint8_t, TABLE_BYTES(capacity));
     for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL;
+        resized.entries[i].key = NULL;
+        resized.entries[i].value = NIL_VAL;
     }
-    table->count = 0;
-    for (int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
+    uint8_t* control = controlBytes(&resized);
+    memset(control, CONTROL_EMPTY, CONTROL_BYTES(capacity));
+
+    // Tombstones don't make the move, and none of the keys can already be in the new table
+    int slotCount;
+    Entry* entries = allEntries(table, &slotCount);
+    for (int i = 0; i < slotCount; i++) {
+        Entry* entry = &entries[i];
         if (entry->key == NULL) continue;
 
-        Entry* dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
-        table->count++;
+        int slot = findFreeSlot(&resized, entry->key->hash);
+        control[slot] = HASH_TAG(entry->key->hash);
+        resized.entries[slot] = *entry;
+        resized.count++;
     }
 
-    FREE_ARRAY(Entry, table->entries, table->capacity);
-
-    table->entries = entries;
-    table->capacity = capacity;
+    freeTable(table);
+    *table = resized;
 }
 
 bool tableSet(Table* table, ObjString* key, Value value) {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+    if (table->capacity == 0) {
+        int index = findInline(table, key);
+        if (index >= 0) {
+            table->inlineEntries[index].value = value;
+            return false;
+        }
+        if (table->count < TABLE_INLINE_CAPACITY) {
+            table->inlineEntries[table->count].key = key;
+            table->inlineEntries[table->count].value = value;
+            table->count++;
+            return true;
+        }
+        // Out of room, so the entries move out to a hashed layout
+        adjustCapacity(table, TABLE_MIN_CAPACITY);
+    } else {
+        int slot = findSlot(table, key);
+        if (slot >= 0) {
+            table->entries[slot].value = value;
+            return false;
+        }
+        if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+            adjustCapacity(table, table->capacity * 2);
+        }
     }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
+    int slot = findFreeSlot(table, key->hash);
+    uint8_t* control = controlBytes(table);
     // Replacing tomstones will not increment the count
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
-
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    if (control[slot] == CONTROL_EMPTY) table->count++;
+    control[slot] = HASH_TAG(key->hash);
+    table->entries[slot].key = key;
+    table->entries[slot].value = value;
+    return true;
 }
 
 void tableAddAll(Table* from, Table* to) {
-    for (int i = 0; i < from->capacity; i++) {
-        Entry* entry = &from->entries[i];
+    int slotCount;
+    Entry* entries = allEntries(from, &slotCount);
+    for (int i = 0; i < slotCount; i++) {
+        Entry* entry = &entries[i];
         if (entry->key != NULL) {
             tableSet(to, entry->key, entry->value);
         }
@@ -93,60 +228,196 @@ void tableAddAll(Table* from, Table* to) {
 }
 
 bool tableGet(Table* table, ObjString* key, Value* value) {
-    if (table->count == 0) return false;
+    if (table->capacity == 0) {
+        int index = findInline(table, key);
+        if (index < 0) return false;
+        *value = table->inlineEntries[index].value;
+        return true;
+    }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    int slot = findSlot(table, key);
+    if (slot < 0) return false;
 
-    *value = entry->value;
+    *value = table->entries[slot].value;
     return true;
 }
 
 // We use the tombstoning technique to handle key deletions
 // Return whether or not our deletion attempt was successful
 bool tableDelete(Table* table, ObjString* key) {
-    if (table->count == 0) return false;
+    if (table->capacity == 0) {
+        int index = findInline(table, key);
+        if (index < 0) return false;
+        // Inline entries stay packed, so the last one fills the hole
+        table->count--;
+        table->inlineEntries[index] = table->inlineEntries[table->count];
+        table->inlineEntries[table->count].key = NULL;
+        table->inlineEntries[table->count].value = NIL_VAL;
+        return true;
+    }
 
-    Entry* entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    int slot = findSlot(table, key);
+    if (slot < 0) return false;
 
-    // The actual "tombstone"
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    uint8_t* control = controlBytes(table);
+    // A probe never gets past a group with an empty slot in it, so in such a group nothing needs a tombstone
+    if (matchEmpty(control + (slot & ~(GROUP_SIZE - 1))) != 0) {
+        control[slot] = CONTROL_EMPTY;
+        table->count--;
+    } else {
+        control[slot] = CONTROL_DELETED;
+    }
+    table->entries[slot].key = NULL;
+    table->entries[slot].value = NIL_VAL;
+    return true;
+}
+
+static inline bool keyHasChars(ObjString* key, const char* chars, int length, uint32_t hash) {
+    return key->length == length && key->hash == hash && memcmp(key->chars, chars, length) == 0;
 }
 
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash) {
-    if (table->count == 0) return NULL;
-
-    uint32_t index = hash % table->capacity;
-    for (;;) {
-        Entry* entry = &table->entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) return NULL;
-        } else if (
-            entry->key->length == length
-            && entry->key->hash == hash
-            && memcmp(entry->key->chars, chars, length) == 0) {
-            // we found the key
-            return entry->key;
+    if (table->capacity == 0) {
+        for (int i = 0; i < table->count; i++) {
+            ObjString* key = table->inlineEntries[i].key;
+            if (keyHasChars(key, chars, length, hash)) return key;
+        }
+        return NULL;
+    }
+
+    uint8_t* control = controlBytes(table);
+    uint8_t tag = HASH_TAG(hash);
+
+    FOR_EACH_GROUP(table, hash, group) {
+        int base = (int)group * GROUP_SIZE;
+        GroupMask matches = matchTag(control + base, tag);
+        while (matches != 0) {
+            ObjString* key = table->entries[base + __builtin_ctz(matches)].key;
+            if (keyHasChars(key, chars, length, hash)) {
+                // we found the key
+                return key;
+            }
+            matches &= matches - 1;
+        }
+        if (matchEmpty(control + base) != 0) return NULL;
+    }
+}
+
+/**
+ * Reinserts every entry without leaving the table's own memory, and without any tombstones. Works like the rehash
+ * in Abseil's Swiss tables: every full slot is first flagged as deleted, meaning its entry still has to be
+ * reinserted, and each one then either stays in its group, moves to an empty slot, or swaps with another entry
+ * that is still waiting its turn.
+ */
+static void rehashInPlace(Table* table) {
+    uint8_t* control = controlBytes(table);
+    for (int i = 0; i < table->capacity; i++) {
+        control[i] = control[i] & 0x80 ? CONTROL_EMPTY : CONTROL_DELETED;
+    }
+
+    table->count = 0;
+    int i = 0;
+    while (i < table->capacity) {
+        if (control[i] != CONTROL_DELETED) {
+            i++;
+            continue;
         }
-        index = (index + 1) % table->capacity;
+
+        Entry* entry = &table->entries[i];
+        uint32_t hash = entry->key->hash;
+        int slot = findFreeSlot(table, hash);
+        table->count++;
+        // Probes for the key reach this group before any other free slot, so the entry can stay right where it is
+        if (slot / GROUP_SIZE == i / GROUP_SIZE) {
+            control[i] = HASH_TAG(hash);
+            i++;
+        } else if (control[slot] == CONTROL_EMPTY) {
+            table->entries[slot] = *entry;
+            control[slot] = HASH_TAG(hash);
+            entry->key = NULL;
+            entry->value = NIL_VAL;
+            control[i] = CONTROL_EMPTY;
+            i++;
+        } else {
+            // The slot's entry hasn't been reinserted yet, so it trades places with ours and goes next
+            Entry waiting = table->entries[slot];
+            table->entries[slot] = *entry;
+            control[slot] = HASH_TAG(hash);
+            *entry = waiting;
+        }
+    }
+}
+
+void tableTrim(Table* table) {
+    if (table->capacity == 0) return;
+    int live = 0;
+    for (int i = 0; i < table->capacity; i++) {
+        if (table->entries[i].key != NULL) live++;
+    }
+
+    if (table->capacity > TABLE_MIN_CAPACITY && live < table->capacity * TABLE_MIN_LOAD) {
+        int capacity = TABLE_MIN_CAPACITY;
+        while (live > capacity * TABLE_SHRUNK_LOAD) capacity *= 2;
+        // Rebuilding the table drops its tombstones along the way
+        adjustCapacity(table, capacity);
+    } else if (table->count - live > table->capacity * TABLE_MAX_TOMBSTONES) {
+        rehashInPlace(table);
     }
 }
 
 void tableRemoveWhite(Table* table) {
+    if (table->capacity == 0) {
+        int i = 0;
+        // Deleting moves the last entry into slot i, which then needs looking at too
+        while (i < table->count) {
+            ObjString* key = table->inlineEntries[i].key;
+            if (heapIsMarked(key)) {
+                i++;
+            } else {
+                tableDelete(table, key);
+            }
+        }
+        return;
+    }
+
     for (int i = 0; i < table->capacity; i++) {
         Entry* entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.isMarked) {
+        if (entry->key != NULL && !heapIsMarked(entry->key)) {
             tableDelete(table, entry->key);
         }
     }
 }
 
 void markTable(Table* table) {
-    for (int i = 0; i < table->capacity; i++) {
-        Entry* entry = &table->entries[i];
+    int slotCount;
+    Entry* entries = allEntries(table, &slotCount);
+    for (int i = 0; i < slotCount; i++) {
+        Entry* entry = &entries[i];
+        // Marking only looks at mark bits, so those are what's worth prefetching for the slots coming up
+        if (i + TABLE_PREFETCH_DISTANCE < slotCount) {
+            Entry* ahead = &entries[i + TABLE_PREFETCH_DISTANCE];
+            if (ahead->key != NULL) heapPrefetchMark(ahead->key);
+            if (IS_OBJ(ahead->value)) heapPrefetchMark(AS_OBJ(ahead->value));
+        }
         markObject((Obj*)entry->key);
         markValue(entry->value);
     }
-}
\ No newline at end of file
+}
+
+void forwardTable(Table* table) {
+    int slotCount;
+    Entry* entries = allEntries(table, &slotCount);
+    for (int i = 0; i < slotCount; i++) {
+        Entry* entry = &entries[i];
+        entry->key = heapForward(entry->key);
+        if (IS_OBJ(entry->value)) entry->value.as.obj = heapForward(entry->value.as.obj);
+    }
+}
+
+Entry* tableSlots(Table* table, int* slotCount) {
+    return allEntries(table, slotCount);
+}
+
+size_t tableAllocatedBytes(Table* table) {
+    return TABLE_BYTES(table->capacity);
+}
@@ -13,14 +13,27 @@ typedef struct {
     Value value;
 } Entry;
 
+// Entries a table keeps inside itself before it needs any memory of its own. Most instances have a handful of
+// fields, so they fit here and cost no allocation beyond the instance itself.
+#define TABLE_INLINE_CAPACITY 4
+
 typedef struct {
+    // Tombstones included. In an inline table, the number of entries in use.
     int count;
+    // Always a power of two, or 0 while the table is inline. The control bytes follow the entries, in the same
+    // block (see table.c).
     int capacity;
     Entry* entries;
+    // Searched linearly while capacity is 0, and left unused once the table has grown out of it
+    Entry inlineEntries[TABLE_INLINE_CAPACITY];
 } Table;
 
 void initTable(Table* table);
 void freeTable(Table* table);
+/*
+ * Keys must be interned strings, from copyString(). Tables compare keys by pointer and probe with the hash interning
+ * filled in, so a string built at runtime would never be found, or would end up in the table twice.
+ */
 // In 'table', set 'key' to be associated with 'value'
 bool tableSet(Table* table, ObjString* key, Value value);
 void tableAddAll(Table* from, Table* to);
@@ -32,5 +45,14 @@ ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t
 // Helper function(s) for GC
 // Note: Maybe move to memory header file instead?
 void tableRemoveWhite(Table* table);
+// Clears out the tombstones a lot of deletes leave behind, shrinking the table if it has gotten mostly empty
+void tableTrim(Table* table);
 void markTable(Table* table);
+// Points every key and value at its new home after the heap has been compacted
+void forwardTable(Table* table);
+// For walking a table from outside, as heap dumps do: every slot that may hold an entry. Those not in use have a NULL
+// key.
+Entry* tableSlots(Table* table, int* slotCount);
+// The memory the table has allocated for its entries, 0 while they are inline
+size_t tableAllocatedBytes(Table* table);
 #endif
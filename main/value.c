@@ -50,8 +50,11 @@ bool valuesEqual(Value a, Value b) {
         case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
         case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
         case VAL_NIL: return true;
-        // We use string interning to make this faster
-        case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+        // We use string interning to make this faster, but strings made at runtime aren't interned
+        case VAL_OBJ: {
+            if (IS_STRING(a) && IS_STRING(b)) return stringsEqual(AS_STRING(a), AS_STRING(b));
+            return AS_OBJ(a) == AS_OBJ(b);
+        }
         default: return false;
     }
 }
\ No newline at end of file
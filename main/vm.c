@@ -5,12 +5,17 @@
 #include "vm.h"
 
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
 #include "compiler.h"
 #include "debug.h"
+#include "handles.h"
+#include "heapdump.h"
+#include "opstats.h"
+#include "profiler.h"
 #include "memory.h"
 
 VM vm;
@@ -20,6 +25,103 @@ static Value clockNative(int argcount, Value* args) {
     return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+static Value weakRefNative(int argcount, Value* args) {
+    if (argcount != 1) return NIL_VAL;
+    return OBJ_VAL(newWeakRef(args[0]));
+}
+
+// What the reference refers to, or nil once that has been collected
+static Value weakGetNative(int argcount, Value* args) {
+    if (argcount != 1 || !IS_WEAK_REF(args[0])) return NIL_VAL;
+    return AS_WEAK_REF(args[0])->target;
+}
+
+static Value weakMapNative(int argcount, Value* args) {
+    return OBJ_VAL(newWeakMap());
+}
+
+// Weak maps only take objects as keys, and tell them apart by identity. Anything else reads as missing.
+static bool isWeakMapAccess(int argcount, int expected, Value* args) {
+    return argcount == expected && IS_WEAK_MAP(args[0]) && IS_OBJ(args[1]);
+}
+
+static Value weakMapGetNative(int argcount, Value* args) {
+    Value value;
+    if (!isWeakMapAccess(argcount, 2, args) || !ephemeronGet(&AS_WEAK_MAP(args[0])->table, AS_OBJ(args[1]), &value)) {
+        return NIL_VAL;
+    }
+    return value;
+}
+
+// Returns the value it was given
+static Value weakMapSetNative(int argcount, Value* args) {
+    if (!isWeakMapAccess(argcount, 3, args)) return NIL_VAL;
+    ephemeronSet(&AS_WEAK_MAP(args[0])->table, AS_OBJ(args[1]), args[2]);
+    return args[2];
+}
+
+static Value weakMapHasNative(int argcount, Value* args) {
+    Value value;
+    return BOOL_VAL(isWeakMapAccess(argcount, 2, args)
+                    && ephemeronGet(&AS_WEAK_MAP(args[0])->table, AS_OBJ(args[1]), &value));
+}
+
+static Value weakMapDeleteNative(int argcount, Value* args) {
+    return BOOL_VAL(isWeakMapAccess(argcount, 2, args)
+                    && ephemeronDelete(&AS_WEAK_MAP(args[0])->table, AS_OBJ(args[1])));
+}
+
+static Value weakMapSizeNative(int argcount, Value* args) {
+    if (argcount != 1 || !IS_WEAK_MAP(args[0])) return NIL_VAL;
+    return NUMBER_VAL(ephemeronSize(&AS_WEAK_MAP(args[0])->table));
+}
+
+static void setStat(Handle stats, const char* name, double value) {
+    HandleScope scope = openHandleScope();
+    Handle key = newHandle(OBJ_VAL(copyString(name, (int)strlen(name))));
+    tableSet(&AS_INSTANCE(*stats)->fields, AS_STRING(*key), NUMBER_VAL(value));
+    closeHandleScope(scope);
+}
+
+// The GC's statistics so far, as the fields of a GCStats instance. Times are in seconds, like clock(), and sizes are
+// in bytes.
+static Value gcStatsNative(int argcount, Value* args) {
+    // Building the instance allocates, and may run collections of its own, which shouldn't show up halfway through
+    GCStats stats = vm.gcStats;
+    HandleScope scope = openHandleScope();
+    Handle name = newHandle(OBJ_VAL(copyString("GCStats", 7)));
+    Handle klass = newHandle(OBJ_VAL(newClass(AS_STRING(*name))));
+    Handle instance = newHandle(OBJ_VAL(newInstance(AS_CLASS(*klass))));
+
+    setStat(instance, "collections", (double)stats.collections);
+    setStat(instance, "compactions", (double)stats.compactions);
+    setStat(instance, "bytesFreed", (double)stats.bytesFreed);
+    setStat(instance, "lastFreed", (double)stats.lastFreed);
+    setStat(instance, "liveHeap", (double)stats.liveHeap);
+    setStat(instance, "peakLiveHeap", (double)stats.peakLiveHeap);
+    setStat(instance, "markTime", stats.total.mark / 1e9);
+    setStat(instance, "stringTableTime", stats.total.strings / 1e9);
+    setStat(instance, "sweepTime", stats.total.sweep / 1e9);
+    setStat(instance, "compactTime", stats.total.compact / 1e9);
+    setStat(instance, "pauseTime", stats.total.pause / 1e9);
+    setStat(instance, "lastPause", stats.last.pause / 1e9);
+    setStat(instance, "pauseP50", gcPausePercentile(&stats, 0.5) / 1e9);
+    setStat(instance, "pauseP90", gcPausePercentile(&stats, 0.9) / 1e9);
+    setStat(instance, "pauseP99", gcPausePercentile(&stats, 0.99) / 1e9);
+    setStat(instance, "pauseMax", stats.maxPause / 1e9);
+
+    Value result = *instance;
+    closeHandleScope(scope);
+    return result;
+}
+
+// Writes a heap snapshot to the given path, see heapdump.h. Returns whether that worked.
+static Value dumpHeapNative(int argcount, Value* args) {
+    if (argcount != 1 || !IS_ANY_STRING(args[0])) return BOOL_VAL(false);
+    ObjString* path = IS_ROPE(args[0]) ? flattenRope(AS_ROPE(args[0])) : AS_STRING(args[0]);
+    return BOOL_VAL(dumpHeap(path->chars));
+}
+
 static void resetStack() {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
@@ -40,66 +142,102 @@ static void runtimeError(const char* format, ...) {
      */
     for (int i = vm.frameCount - 1; i >= 0; i--) {
         CallFrame* frame = &vm.frames[i];
-        ObjFunction* function = frame->closure->function;
+        ObjFunction* function = LOAD_REF(ObjFunction, frame->closure->function);
         size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        fprintf(stderr, "[line %d] in ", getLine(&function->chunk, (int)instruction));
 
         // We are in the top level
-        if (function->name == NULL) {
+        if (heapUnpack(function->name) == NULL) {
             fprintf(stderr, "script\n");
         } else {
             // We are in some other function
-            fprintf(stderr, "%s()\n", function->name->chars);
+            fprintf(stderr, "%s()\n", LOAD_REF(ObjString, function->name)->chars);
         }
     }
     resetStack();
 }
 
+// Raised at a safepoint once the heap has gone over its limit, see trackAllocation()
+static InterpretResult outOfMemory() {
+    vm.outOfMemory = false;
+    runtimeError("Out of memory, the heap went past its limit of %zu bytes", vm.heapLimit);
+    return INTERPRET_RUNTIME_ERROR;
+}
+
 /**
  * Helper function for defining native functions goes here.
  * @param name The name of the native function to be defined
  * @param function The actual function the name will be bound to
  */
 static void defineNative(const char* name, NativeFn function) {
-    // We push and pop the function name and function object onto the stack because
-    /** copyString and newNative both dynamically allocate memory, so our GC needs to know we still need
-     * the name and ObjFunction
-     */
-    push(OBJ_VAL(copyString(name, (int)strlen(name))));
-    push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
-    pop();
-    pop();
-
+    // copyString, newNative and tableSet can all collect, so both objects are held through handles until the
+    // table has them
+    HandleScope scope = openHandleScope();
+    Handle nameHandle = newHandle(OBJ_VAL(copyString(name, (int)strlen(name))));
+    Handle native = newHandle(OBJ_VAL(newNative(function)));
+    tableSet(&vm.globals, AS_STRING(*nameHandle), *native);
+    closeHandleScope(scope);
 }
 // Setup
 void initVM() {
     resetStack();
-    vm.objs = NULL;
+    seedStringHash();
+    initHeap(&vm.heap);
     initTable(&vm.strings);
     initTable(&vm.globals);
 
-    // Copying a string can trigger a GC, so we init to NULL first
-    // so that our GC doesn't read an uninitialized field
-    vm.initString = NULL;
-    vm.initString = copyString("init", 4);
-
+    // Everything the GC keeps track of has to be set up before the first allocation, or that allocation goes
+    // uncounted
     vm.grayCount = 0;
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
+    vm.handleCount = 0;
+    vm.weakRefs = NULL;
+    vm.weakMaps = NULL;
 
+    initGCPacing(&vm.gcPacing);
+    vm.heapLimit = 0;
+    vm.outOfMemory = false;
     vm.bytesAllocated = 0;
-    vm.nextGC = 1024 * 1024;
+    vm.nextGC = vm.gcPacing.minHeap;
+    vm.bytesSurvived = 0;
+    vm.lastCollectionEnd = clock();
+    vm.compactRequested = false;
+    vm.compactedFrom = 0;
+    vm.collecting = false;
+    initGCStats(&vm.gcStats);
+    initAllocProfile(&vm.allocProfile);
+
+    // Copying a string can trigger a GC, so we init to NULL first
+    // so that our GC doesn't read an uninitialized field
+    vm.initString = NULL;
+    vm.initString = copyString("init", 4);
 
     // Native functions go HERE
     defineNative("clock", clockNative);
+    defineNative("weakRef", weakRefNative);
+    defineNative("weakGet", weakGetNative);
+    defineNative("weakMap", weakMapNative);
+    defineNative("weakMapGet", weakMapGetNative);
+    defineNative("weakMapSet", weakMapSetNative);
+    defineNative("weakMapHas", weakMapHasNative);
+    defineNative("weakMapDelete", weakMapDeleteNative);
+    defineNative("weakMapSize", weakMapSizeNative);
+    defineNative("gcStats", gcStatsNative);
+    defineNative("dumpHeap", dumpHeapNative);
 }
 // Cleaning up after ourselves
 void freeVM() {
+    // The profiler's samples point at functions, which are about to go
+    stopProfiler();
+#ifdef DEBUG_OPCODE_STATS
+    flushInstructionSites();
+#endif
     freeTable(&vm.globals);
     freeTable(&vm.strings);
     vm.initString = NULL;
     freeObjects();
+    freeHeap(&vm.heap);
 }
 
 void push(Value value) {
@@ -123,8 +261,9 @@ static Value peek(int distance) {
  * @return Whether or not the function call was succesful
  */
 static bool call(ObjClosure* closure, int argc) {
-    if (closure->function->arity != argc) {
-        runtimeError("Expected %d arguments, but got %d", closure->function->arity, argc);
+    ObjFunction* function = LOAD_REF(ObjFunction, closure->function);
+    if (function->arity != argc) {
+        runtimeError("Expected %d arguments, but got %d", function->arity, argc);
         return false;
     }
 
@@ -133,10 +272,13 @@ static bool call(ObjClosure* closure, int argc) {
         return false;
     }
 
-    CallFrame* frame = &vm.frames[vm.frameCount++];
+    // The profiler's signal handler may look at the frames at any point, so the frame only counts once it is filled in
+    CallFrame* frame = &vm.frames[vm.frameCount];
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
+    frame->ip = function->chunk.code;
     frame->slots = vm.stackTop - argc - 1;
+    atomic_signal_fence(memory_order_release);
+    vm.frameCount++;
     return true;
 }
 
@@ -163,7 +305,7 @@ static bool callValue(Value callee, int argcount) {
                 vm.stackTop[-argcount - 1] = OBJ_VAL(newInstance(klass));
                 // Whenever we create a new instance of a class, attempt to call 'init(...)' if defined
                 Value initializer;
-                if (!tableGet(&klass->methods, vm.initString, &initializer)) {
+                if (tableGet(&klass->methods, vm.initString, &initializer)) {
                     return call(AS_CLOSURE(initializer), argcount);
                 } else if (argcount != 0) {
                     runtimeError("Expected 0 arguments for class initializer, got %d", argcount);
@@ -176,7 +318,7 @@ static bool callValue(Value callee, int argcount) {
                 // Ensures the receiver is in slot 0.
                 vm.stackTop[-argcount - 1] = bound_method->receiver;
 
-                return call(bound_method->method, argcount);
+                return call(LOAD_REF(ObjClosure, bound_method->method), argcount);
             }
             default:
                 break; // Not a callable object type
@@ -196,7 +338,7 @@ static bool bindMethod(ObjClass* klass, ObjString* name) {
     Value method;
     bool isTrue = !tableGet(&klass->methods, name, &method);
     if(isTrue) {
-        runtimeError("Unknown property of '%s', '%s'", klass->name->chars, name->chars);
+        runtimeError("Unknown property of '%s', '%s'", LOAD_REF(ObjString, klass->name)->chars, name->chars);
         return false;
     }
 
@@ -212,20 +354,20 @@ static ObjUpvalue* captureUpvalue(Value* local) {
     ObjUpvalue* upvalue = vm.openUpvalues;
     while (upvalue != NULL && upvalue->location > local) {
         prevUpvalue = upvalue;
-        upvalue = upvalue->next;
+        upvalue = LOAD_REF(ObjUpvalue, upvalue->next);
     }
 
-    if (upvalue != NULL && upvalue->location > local) {
+    if (upvalue != NULL && upvalue->location == local) {
         return upvalue;
     }
 
     ObjUpvalue* createdUpvalue = newUpvalue(local);
-    createdUpvalue->next = upvalue;
+    createdUpvalue->next = heapPack(upvalue);
 
     if (prevUpvalue == NULL) {
         vm.openUpvalues = createdUpvalue;
     } else {
-        prevUpvalue->next = createdUpvalue;
+        prevUpvalue->next = heapPack(createdUpvalue);
     }
     return createdUpvalue;
 }
@@ -239,27 +381,49 @@ static void closeUpvalues(Value* last) {
         ObjUpvalue* upvalue = vm.openUpvalues;
         upvalue->closed = *upvalue->location;
         upvalue->location = &upvalue->closed;
-        vm.openUpvalues = upvalue->next;
+        vm.openUpvalues = LOAD_REF(ObjUpvalue, upvalue->next);
     }
 }
 
 static bool isFalsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
-// Concatenates two strings together
+// A flattened rope is as good as its flat string
+static Value flatOrRope(Value value) {
+    if (!IS_ROPE(value)) return value;
+    ObjString* flat = LOAD_REF(ObjString, AS_ROPE(value)->flat);
+    return flat != NULL ? OBJ_VAL(flat) : value;
+}
+
+// Concatenates two strings together, either of which may be a rope
 static void concatenate() {
-    ObjString* b = AS_STRING(peek(0));
-    ObjString* a = AS_STRING(peek(0));
-
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
-    ObjString* result = takeString(chars, length);
+    Value b = flatOrRope(peek(0));
+    Value a = flatOrRope(peek(1));
+    int length = stringLength(a) + stringLength(b);
+
+    // Both operands are still on the stack, so they survive a collection here
+    Value result;
+    if (stringLength(a) == 0) {
+        result = b;
+    } else if (stringLength(b) == 0) {
+        result = a;
+    } else if (length < ROPE_MIN_LENGTH && IS_STRING(a) && IS_STRING(b)) {
+        ObjString* string = allocateString(length);
+        memcpy(string->chars, AS_STRING(a)->chars, AS_STRING(a)->length);
+        memcpy(string->chars + AS_STRING(a)->length, AS_STRING(b)->chars, AS_STRING(b)->length);
+        result = OBJ_VAL(string);
+    } else {
+        result = OBJ_VAL(newRope(AS_OBJ(a), AS_OBJ(b), length));
+    }
     pop();
     pop();
-    push(OBJ_VAL(result));
+    push(result);
+}
+
+// Swaps a rope on the stack for the flat string it spells out
+static void flattenSlot(int distance) {
+    Value value = peek(distance);
+    if (IS_ROPE(value)) vm.stackTop[-1 - distance] = OBJ_VAL(flattenRope(AS_ROPE(value)));
 }
 
 static void defineMethod(ObjString* methodName) {
@@ -273,7 +437,7 @@ static void defineMethod(ObjString* methodName) {
 static bool invokeFromClass(ObjClass* klass, ObjString* method_name, int argc) {
     Value method;
     if(!tableGet(&klass->methods, method_name, &method)) {
-        runtimeError("Class %s does not have method %s.", klass->name->chars, method_name->chars);
+        runtimeError("Class %s does not have method %s.", LOAD_REF(ObjString, klass->name)->chars, method_name->chars);
         return false;
     }
     return call(AS_CLOSURE(method), argc);
@@ -293,8 +457,8 @@ static bool invoke(ObjString* method_name, int argc) {
         return false;
     }
 
-    ObjInstance* instance = AS_STRING(receiver);
-    return invokeFromClass(instance->klass, method_name, argc);
+    ObjInstance* instance = AS_INSTANCE(receiver);
+    return invokeFromClass(LOAD_REF(ObjClass, instance->klass), method_name, argc);
 }
 
 // The main function of our VM, the "beating heart" so to speak.
@@ -314,8 +478,11 @@ static InterpretResult run() {
     } while (false)
 #define READ_SHORT() \
     (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
+#define READ_CONSTANT() (LOAD_REF(ObjFunction, frame->closure->function)->chunk.constants.values[READ_BYTE()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
+#ifdef DEBUG_OPCODE_STATS
+    resetInstructionTimer();
+#endif
     for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
         printf("        ");
@@ -325,7 +492,11 @@ static InterpretResult run() {
             printf("  ]");
         }
         printf("\n");
-        disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+        Chunk* chunk = &LOAD_REF(ObjFunction, frame->closure->function)->chunk;
+        disassembleInstruction(chunk, (int)(frame->ip - chunk->code));
+#endif
+#ifdef DEBUG_OPCODE_STATS
+        countInstruction(LOAD_REF(ObjFunction, frame->closure->function), frame->ip);
 #endif
         uint8_t instruction;
         switch(instruction = READ_BYTE()) {
@@ -358,7 +529,7 @@ static InterpretResult run() {
                 break;
             }
             case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                if (IS_ANY_STRING(peek(0)) && IS_ANY_STRING(peek(1))) {
                     concatenate();
                 } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
                     BINARY_OP(NUMBER_VAL, +);
@@ -386,6 +557,13 @@ static InterpretResult run() {
             case OP_TRUE: push(BOOL_VAL(true)); break;
             case OP_FALSE: push(BOOL_VAL(false)); break;
             case OP_EQUAL: {
+                // Ropes need their characters in one place to be compared.
+                // Strings of different lengths can never be equal though, so there is no need to flatten those.
+                if ((IS_ROPE(peek(0)) || IS_ROPE(peek(1))) && IS_ANY_STRING(peek(0)) && IS_ANY_STRING(peek(1))
+                    && stringLength(peek(0)) == stringLength(peek(1))) {
+                    flattenSlot(0);
+                    flattenSlot(1);
+                }
                 Value b = pop();
                 Value a = pop();
                 push(BOOL_VAL(valuesEqual(a, b)));
@@ -451,15 +629,26 @@ static InterpretResult run() {
             }
             case OP_LOOP: {
                 uint16_t offset = READ_SHORT();
+                // Backward jumps and calls are our safepoints; nothing outside the VM holds an object here.
+                // The jump comes after, so that the GC finds ip in this instruction and uses its stack map entry.
+                if (vm.compactRequested) compactHeap();
+                if (vm.outOfMemory) return outOfMemory();
+                if (heapDumpRequested) dumpHeapOnRequest();
+                if (profileDrainRequested) drainProfile();
                 frame->ip -= offset;
                 break;
             }
             case OP_CALL: {
                 int argcount = READ_BYTE();
+                // Raised before the call, so that the error points at the line making it
+                if (vm.outOfMemory) return outOfMemory();
                 if (!callValue(peek(argcount), argcount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frameCount - 1];
+                if (vm.compactRequested) compactHeap();
+                if (heapDumpRequested) dumpHeapOnRequest();
+                if (profileDrainRequested) drainProfile();
                 break;
             }
             case OP_CLOSURE: {
@@ -471,7 +660,7 @@ static InterpretResult run() {
                     uint8_t isLocal = READ_BYTE();
                     uint8_t index = READ_BYTE();
                     if (isLocal) {
-                        closure->upvalues[i] = captureUpvalue(frame->slots + index);
+                        closure->upvalues[i] = heapPack(captureUpvalue(frame->slots + index));
                     } else {
                         closure->upvalues[i] =  frame->closure->upvalues[index];
                     }
@@ -480,12 +669,12 @@ static InterpretResult run() {
             }
             case OP_GET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
-                push(*frame->closure->upvalues[slot]->location);
+                push(*LOAD_REF(ObjUpvalue, frame->closure->upvalues[slot])->location);
                 break;
             }
             case OP_SET_UPVALUE: {
                 uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
+                *LOAD_REF(ObjUpvalue, frame->closure->upvalues[slot])->location = peek(0);
                 break;
             }
             case OP_CLOSE_UPVALUE: {
@@ -494,7 +683,7 @@ static InterpretResult run() {
                 break;
             }
             case OP_CLASS: {
-                push(OBJ_CLASS(newClass(READ_STRING())));
+                push(OBJ_VAL(newClass(READ_STRING())));
                 break;
             }
             //
@@ -516,12 +705,10 @@ static InterpretResult run() {
                 }
 
                 // If we could not bind this method call to an instance of the given class either
-                if (!bindMethod(instance->klass, name)) {
+                if (!bindMethod(LOAD_REF(ObjClass, instance->klass), name)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
-
-                runtimeError("Undefined field '%s'", name->chars);
-                return INTERPRET_RUNTIME_ERROR;
+                break;
             }
             // TODO: Implement a strategy to handle deletion of fields from a class
             case OP_SET_PROPERTY: {
@@ -529,7 +716,7 @@ static InterpretResult run() {
                     runtimeError("Only instances of classes may have their fields set");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                ObjInstance* instance = AS_INSTANCE(peek(0));
+                ObjInstance* instance = AS_INSTANCE(peek(1));
                 tableSet(&instance->fields, READ_STRING(), peek(0));
                 // The value of a setter is in of itself an expression that evalutates to the set value
                 Value value = pop();
@@ -567,14 +754,16 @@ static InterpretResult run() {
  * @return Whether the code was interpreted successfully, or if there was a compile/runtime error.
  */
 InterpretResult interpret(const char* source) {
+    // A script that ran out of memory right before it finished leaves nothing for the next one to raise
+    vm.outOfMemory = false;
     ObjFunction* function = compile(source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
 
-    // Pushing the raw function object is still useful even if we immediately pop it off afterwards;
-    // It keeps the gc aware of our heap allocated objects
-    push(OBJ_VAL(function));
-    ObjClosure* closure = newClosure(function);
-    pop();
+    // The function isn't referenced by anything else while its closure is allocated
+    HandleScope scope = openHandleScope();
+    Handle script = newHandle(OBJ_VAL(function));
+    ObjClosure* closure = newClosure(AS_FUNCTION(*script));
+    closeHandleScope(scope);
     push(OBJ_VAL(closure));
     call(closure, 0);
 
@@ -9,12 +9,21 @@
 #ifndef clox_vm_h
 #define clox_vm_h
 
+#include <signal.h>
+#include <time.h>
+
+#include "allocprof.h"
 #include "chunk.h"
+#include "gcstats.h"
+#include "heap.h"
+#include "memory.h"
 #include "object.h"
 #include "table.h"
 
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+// How many handles can be open at once, see handles.h
+#define HANDLES_MAX 256
 
 typedef struct {
 	ObjClosure* closure;
@@ -29,21 +38,44 @@ typedef struct {
 
     Value stack[STACK_MAX];
     Value* stackTop;
-    Obj* objs;
+	// Where every object's memory (and its mark bit) lives
+	Heap heap;
     // Keeps track of all strings recorded so far, for string interning
     Table strings;
 	// Special string we intern for fast lookup;
 	// Defines the string we use to define the initailizer method of a class
 	ObjString* initString;
 	ObjUpvalue* openUpvalues;
+	// Temporaries of the C code, rooted through handles.h
+	Value handles[HANDLES_MAX];
+	int handleCount;
     // Keeps track of all global variables
     Table globals;
 	int grayCount;
 	int grayCapacity;
 	Obj** grayStack;
+	// The weak references and weak maps the collection in progress has reached so far
+	ObjWeakRef* weakRefs;
+	ObjWeakMap* weakMaps;
 	// Values we use to auto adjust GC frequency
 	size_t bytesAllocated;
 	size_t nextGC;
+	GCPacing gcPacing;
+	// 0 if unlimited
+	size_t heapLimit;
+	// Set once a collection couldn't get the heap back under its limit, until the VM raises the error
+	bool outOfMemory;
+	// What was left allocated after the last collection, and the CPU clock when it finished
+	size_t bytesSurvived;
+	clock_t lastCollectionEnd;
+	// Set by the GC when the heap has become fragmented enough to be worth compacting at the next safepoint
+	bool compactRequested;
+	// Size of the object heap when the last compaction was requested
+	size_t compactedFrom;
+	// Set for the duration of a collection. The profiler's signal handler reads it.
+	volatile sig_atomic_t collecting;
+	GCStats gcStats;
+	AllocProfile allocProfile;
 } VM;
 
 typedef enum {
@@ -0,0 +1,575 @@
+//
+// Created by aaron on 10/18/2026.
+//
+
+/**
+ * Reads a heap dump written by clox (see main/heapdump.h) and reports what is keeping the memory alive.
+ *
+ *     heapanalyze clox-heap-1234-1.json
+ *
+ * An object's retained size is what would be freed if it went away: its own size plus that of every object only
+ * reachable through it, which are the objects it dominates. The report sums shallow and retained sizes per class,
+ * and lists the objects retaining the most along with how they are reached from the roots.
+ *
+ * Retained sizes per class don't count an object more than once: an object inside another of the same class, like
+ * the rest of a linked list past its head, is already part of the outer one's retained size.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// How many classes and objects the report lists, and how far back it follows a path to the roots
+#define REPORT_CLASSES 30
+#define REPORT_OBJECTS 10
+#define REPORT_PATH_LENGTH 8
+
+typedef struct {
+    uint64_t id;
+    uint64_t parent;
+    uint64_t size;
+    uint64_t retained;
+    int label;
+    // Where the node's outgoing edges start in the edge array, and how many there are
+    int firstEdge;
+    int edgeCount;
+    // Only set on roots
+    char* root;
+} Node;
+
+typedef struct {
+    // Node 0 stands for the roots as a whole, every root is an edge out of it
+    Node* nodes;
+    int count;
+    int capacity;
+    // Ids at first, turned into node indices once every node has been read
+    uint64_t* edges;
+    int edgeCount;
+    int edgeCapacity;
+    char** labels;
+    int labelCount;
+    int labelCapacity;
+    // Maps ids to node indices, open addressing, -1 for empty
+    int* index;
+    int indexCapacity;
+    // The nodes with a root
+    int* roots;
+    int rootCount;
+} Graph;
+
+static void* checked(void* pointer) {
+    if (pointer == NULL) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(1);
+    }
+    return pointer;
+}
+
+#define GROW(array, count, capacity) \
+    do { \
+        if ((count) + 1 > (capacity)) { \
+            (capacity) = (capacity) < 8 ? 8 : (capacity) * 2; \
+            (array) = checked(realloc((array), sizeof(*(array)) * (capacity))); \
+        } \
+    } while (false)
+
+static int internLabel(Graph* graph, const char* label) {
+    for (int i = 0; i < graph->labelCount; i++) {
+        if (strcmp(graph->labels[i], label) == 0) return i;
+    }
+    GROW(graph->labels, graph->labelCount, graph->labelCapacity);
+    graph->labels[graph->labelCount] = checked(strdup(label));
+    return graph->labelCount++;
+}
+
+static uint64_t hashId(uint64_t id) {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccd;
+    return id ^ (id >> 33);
+}
+
+static void buildIndex(Graph* graph) {
+    graph->indexCapacity = 16;
+    while (graph->indexCapacity < graph->count * 2) graph->indexCapacity *= 2;
+    graph->index = checked(malloc(sizeof(int) * graph->indexCapacity));
+    memset(graph->index, -1, sizeof(int) * graph->indexCapacity);
+    for (int i = 1; i < graph->count; i++) {
+        uint64_t slot = hashId(graph->nodes[i].id) & (graph->indexCapacity - 1);
+        while (graph->index[slot] != -1) slot = (slot + 1) & (graph->indexCapacity - 1);
+        graph->index[slot] = i;
+    }
+}
+
+// -1 if no object has that id
+static int findNode(Graph* graph, uint64_t id) {
+    uint64_t slot = hashId(id) & (graph->indexCapacity - 1);
+    while (graph->index[slot] != -1) {
+        if (graph->nodes[graph->index[slot]].id == id) return graph->index[slot];
+        slot = (slot + 1) & (graph->indexCapacity - 1);
+    }
+    return -1;
+}
+
+/*
+ * Just enough JSON for the lines clox writes: an object of strings, numbers and arrays of numbers.
+ */
+typedef struct {
+    const char* current;
+} Parser;
+
+static void skipSpace(Parser* parser) {
+    while (*parser->current == ' ' || *parser->current == '\t') parser->current++;
+}
+
+static bool match(Parser* parser, char c) {
+    skipSpace(parser);
+    if (*parser->current != c) return false;
+    parser->current++;
+    return true;
+}
+
+// Reads a string into 'buffer', cutting it short if it doesn't fit
+static bool parseString(Parser* parser, char* buffer, size_t size) {
+    if (!match(parser, '"')) return false;
+    size_t length = 0;
+    while (*parser->current != '"') {
+        char c = *parser->current++;
+        if (c == '\0' || c == '\n') return false;
+        if (c == '\\') {
+            c = *parser->current++;
+            if (c == 'u') {
+                c = (char)strtol((char[]){parser->current[0], parser->current[1], parser->current[2],
+                                          parser->current[3], '\0'}, NULL, 16);
+                parser->current += 4;
+            } else if (c == 'n') {
+                c = '\n';
+            } else if (c == 't') {
+                c = '\t';
+            }
+        }
+        if (length + 1 < size) buffer[length++] = c;
+    }
+    parser->current++;
+    buffer[length] = '\0';
+    return true;
+}
+
+static bool parseNumber(Parser* parser, uint64_t* number) {
+    skipSpace(parser);
+    char* end;
+    *number = strtoull(parser->current, &end, 10);
+    if (end == parser->current) return false;
+    parser->current = end;
+    return true;
+}
+
+// Skips a value of a key this doesn't know about
+static bool skipValue(Parser* parser) {
+    char buffer[8];
+    uint64_t number;
+    skipSpace(parser);
+    if (*parser->current == '"') return parseString(parser, buffer, sizeof(buffer));
+    if (*parser->current == '[') {
+        int depth = 0;
+        do {
+            if (*parser->current == '\0') return false;
+            if (*parser->current == '[') depth++;
+            if (*parser->current == ']') depth--;
+            parser->current++;
+        } while (depth > 0);
+        return true;
+    }
+    return parseNumber(parser, &number);
+}
+
+static bool parseLine(Graph* graph, const char* line, bool* isHeader) {
+    Parser parser = {line};
+    if (!match(&parser, '{')) return false;
+
+    Node node = {0};
+    node.firstEdge = graph->edgeCount;
+    char type[64] = "";
+    char name[256] = "";
+    char root[512] = "";
+    bool hasId = false;
+    *isHeader = false;
+    while (!match(&parser, '}')) {
+        char key[32];
+        if (!parseString(&parser, key, sizeof(key)) || !match(&parser, ':')) return false;
+        bool parsed;
+        if (strcmp(key, "format") == 0) {
+            char format[32];
+            parsed = parseString(&parser, format, sizeof(format));
+            if (strcmp(format, "clox-heap") != 0) return false;
+            *isHeader = true;
+        } else if (strcmp(key, "id") == 0) {
+            parsed = hasId = parseNumber(&parser, &node.id);
+        } else if (strcmp(key, "parent") == 0) {
+            parsed = parseNumber(&parser, &node.parent);
+        } else if (strcmp(key, "size") == 0) {
+            parsed = parseNumber(&parser, &node.size);
+        } else if (strcmp(key, "type") == 0) {
+            parsed = parseString(&parser, type, sizeof(type));
+        } else if (strcmp(key, "class") == 0) {
+            parsed = parseString(&parser, name, sizeof(name));
+        } else if (strcmp(key, "root") == 0) {
+            parsed = parseString(&parser, root, sizeof(root));
+        } else if (strcmp(key, "refs") == 0) {
+            parsed = match(&parser, '[');
+            while (parsed && !match(&parser, ']')) {
+                uint64_t id;
+                if (graph->edgeCount > node.firstEdge && !match(&parser, ',')) return false;
+                if (!parseNumber(&parser, &id)) return false;
+                GROW(graph->edges, graph->edgeCount, graph->edgeCapacity);
+                graph->edges[graph->edgeCount++] = id;
+            }
+        } else {
+            parsed = skipValue(&parser);
+        }
+        if (!parsed) return false;
+        match(&parser, ',');
+    }
+    if (*isHeader) return true;
+    if (!hasId) return false;
+
+    // Instances go by their class, anything else by its type
+    char label[320];
+    if (name[0] != '\0') {
+        snprintf(label, sizeof(label), "%s", name);
+    } else {
+        snprintf(label, sizeof(label), "(%s)", type);
+    }
+    node.label = internLabel(graph, label);
+    node.edgeCount = graph->edgeCount - node.firstEdge;
+    if (root[0] != '\0') node.root = checked(strdup(root));
+    GROW(graph->nodes, graph->count, graph->capacity);
+    graph->nodes[graph->count++] = node;
+    return true;
+}
+
+static void readGraph(Graph* graph, FILE* file, const char* path) {
+    memset(graph, 0, sizeof(Graph));
+    GROW(graph->nodes, graph->count, graph->capacity);
+    graph->nodes[graph->count++] = (Node){0};
+
+    char* line = NULL;
+    size_t lineCapacity = 0;
+    int lineNumber = 0;
+    bool sawHeader = false;
+    while (getline(&line, &lineCapacity, file) != -1) {
+        lineNumber++;
+        if (line[0] == '\n' || line[0] == '\0') continue;
+        bool isHeader;
+        if (!parseLine(graph, line, &isHeader) || (!sawHeader && !isHeader)) {
+            fprintf(stderr, "%s:%d: not a clox heap dump line.\n", path, lineNumber);
+            exit(65);
+        }
+        sawHeader = true;
+    }
+    free(line);
+
+    buildIndex(graph);
+    // Edges to objects missing from the dump can only come from a dump that was cut short, and are dropped
+    int kept = 0;
+    for (int i = 1; i < graph->count; i++) {
+        Node* node = &graph->nodes[i];
+        int first = kept;
+        for (int j = node->firstEdge; j < node->firstEdge + node->edgeCount; j++) {
+            int target = findNode(graph, graph->edges[j]);
+            if (target > 0) graph->edges[kept++] = (uint64_t)target;
+        }
+        node->firstEdge = first;
+        node->edgeCount = kept - first;
+    }
+    graph->edgeCount = kept;
+
+    graph->roots = checked(malloc(sizeof(int) * graph->count));
+    for (int i = 1; i < graph->count; i++) {
+        if (graph->nodes[i].root != NULL) graph->roots[graph->rootCount++] = i;
+    }
+}
+
+static void freeGraph(Graph* graph) {
+    for (int i = 0; i < graph->count; i++) free(graph->nodes[i].root);
+    for (int i = 0; i < graph->labelCount; i++) free(graph->labels[i]);
+    free(graph->nodes);
+    free(graph->edges);
+    free(graph->labels);
+    free(graph->index);
+    free(graph->roots);
+}
+
+typedef struct {
+    // Every node, in the order a depth first walk from node 0 finished with them
+    int* postorder;
+    // Each node's position in postorder, -1 if the walk never got to it
+    int* order;
+    int* idom;
+    int reachable;
+} Dominators;
+
+// The targets of a node's edges. Node 0 has an edge to each root.
+static int successorCount(Graph* graph, int node) {
+    return node == 0 ? graph->rootCount : graph->nodes[node].edgeCount;
+}
+
+static int successor(Graph* graph, int node, int i) {
+    if (node == 0) return graph->roots[i];
+    return (int)graph->edges[graph->nodes[node].firstEdge + i];
+}
+
+static int intersect(Dominators* dominators, int a, int b) {
+    while (a != b) {
+        while (dominators->order[a] < dominators->order[b]) a = dominators->idom[a];
+        while (dominators->order[b] < dominators->order[a]) b = dominators->idom[b];
+    }
+    return a;
+}
+
+/*
+ * Dominators the way Cooper, Harvey and Kennedy compute them: go over the nodes in reverse postorder, setting each
+ * one's immediate dominator to the closest common dominator of its predecessors, until nothing changes.
+ */
+static void findDominators(Graph* graph, Dominators* dominators) {
+    int count = graph->count;
+    dominators->postorder = checked(malloc(sizeof(int) * count));
+    dominators->order = checked(malloc(sizeof(int) * count));
+    dominators->idom = checked(malloc(sizeof(int) * count));
+    for (int i = 0; i < count; i++) {
+        dominators->order[i] = -1;
+        dominators->idom[i] = -1;
+    }
+
+    // Depth first, with an explicit stack of nodes and how many of their successors have been looked at
+    int* stack = checked(malloc(sizeof(int) * count));
+    int* next = checked(calloc(count, sizeof(int)));
+    bool* seen = checked(calloc(count, sizeof(bool)));
+    int depth = 0;
+    int finished = 0;
+    stack[depth++] = 0;
+    seen[0] = true;
+    while (depth > 0) {
+        int node = stack[depth - 1];
+        if (next[node] < successorCount(graph, node)) {
+            int target = successor(graph, node, next[node]++);
+            if (!seen[target]) {
+                seen[target] = true;
+                stack[depth++] = target;
+            }
+        } else {
+            depth--;
+            dominators->order[node] = finished;
+            dominators->postorder[finished++] = node;
+        }
+    }
+    dominators->reachable = finished;
+
+    // Predecessors, in the same layout as the edges
+    int* predecessorStart = checked(calloc(count + 1, sizeof(int)));
+    for (int node = 0; node < count; node++) {
+        for (int i = 0; i < successorCount(graph, node); i++) {
+            predecessorStart[successor(graph, node, i) + 1]++;
+        }
+    }
+    for (int i = 0; i < count; i++) predecessorStart[i + 1] += predecessorStart[i];
+    int* predecessors = checked(malloc(sizeof(int) * (predecessorStart[count] + 1)));
+    int* filled = checked(calloc(count, sizeof(int)));
+    for (int node = 0; node < count; node++) {
+        for (int i = 0; i < successorCount(graph, node); i++) {
+            int target = successor(graph, node, i);
+            predecessors[predecessorStart[target] + filled[target]++] = node;
+        }
+    }
+
+    dominators->idom[0] = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        // Reverse postorder, skipping node 0 itself
+        for (int i = finished - 2; i >= 0; i--) {
+            int node = dominators->postorder[i];
+            int idom = -1;
+            for (int j = predecessorStart[node]; j < predecessorStart[node + 1]; j++) {
+                int predecessor = predecessors[j];
+                if (dominators->idom[predecessor] == -1) continue;
+                idom = idom == -1 ? predecessor : intersect(dominators, predecessor, idom);
+            }
+            if (idom != dominators->idom[node]) {
+                dominators->idom[node] = idom;
+                changed = true;
+            }
+        }
+    }
+
+    free(stack);
+    free(next);
+    free(seen);
+    free(predecessorStart);
+    free(predecessors);
+    free(filled);
+}
+
+static void freeDominators(Dominators* dominators) {
+    free(dominators->postorder);
+    free(dominators->order);
+    free(dominators->idom);
+}
+
+typedef struct {
+    int label;
+    uint64_t count;
+    uint64_t shallow;
+    uint64_t retained;
+} ClassTotal;
+
+static int compareClasses(const void* a, const void* b) {
+    const ClassTotal* left = a;
+    const ClassTotal* right = b;
+    if (left->retained != right->retained) return left->retained < right->retained ? 1 : -1;
+    return 0;
+}
+
+static Graph* sortedGraph;
+
+static int compareRetained(const void* a, const void* b) {
+    uint64_t left = sortedGraph->nodes[*(const int*)a].retained;
+    uint64_t right = sortedGraph->nodes[*(const int*)b].retained;
+    if (left != right) return left < right ? 1 : -1;
+    return 0;
+}
+
+// Adds up each class, counting the retained size of only the outermost objects of a class along any dominator path
+static void totalClasses(Graph* graph, Dominators* dominators, ClassTotal* totals) {
+    int count = graph->count;
+    for (int i = 0; i < graph->labelCount; i++) totals[i] = (ClassTotal){i, 0, 0, 0};
+
+    // The dominator tree, as lists of children
+    int* childStart = checked(calloc(count + 1, sizeof(int)));
+    for (int node = 1; node < count; node++) {
+        if (dominators->idom[node] >= 0) childStart[dominators->idom[node] + 1]++;
+    }
+    for (int i = 0; i < count; i++) childStart[i + 1] += childStart[i];
+    int* children = checked(malloc(sizeof(int) * (childStart[count] + 1)));
+    int* filled = checked(calloc(count, sizeof(int)));
+    for (int node = 1; node < count; node++) {
+        int idom = dominators->idom[node];
+        if (idom >= 0) children[childStart[idom] + filled[idom]++] = node;
+    }
+
+    // How many objects of each class are on the path from the top of the tree down to the current node
+    int* active = checked(calloc(graph->labelCount, sizeof(int)));
+    int* stack = checked(malloc(sizeof(int) * count));
+    int* next = checked(calloc(count, sizeof(int)));
+    int depth = 0;
+    stack[depth++] = 0;
+    while (depth > 0) {
+        int node = stack[depth - 1];
+        Node* entry = &graph->nodes[node];
+        if (next[node] == 0 && node != 0) {
+            ClassTotal* total = &totals[entry->label];
+            total->count++;
+            total->shallow += entry->size;
+            if (active[entry->label] == 0) total->retained += entry->retained;
+            active[entry->label]++;
+        }
+        if (next[node] < childStart[node + 1] - childStart[node]) {
+            stack[depth++] = children[childStart[node] + next[node]++];
+        } else {
+            depth--;
+            if (node != 0) active[entry->label]--;
+        }
+    }
+
+    free(childStart);
+    free(children);
+    free(filled);
+    free(active);
+    free(stack);
+    free(next);
+}
+
+static void printPath(Graph* graph, int node) {
+    // Parents always come from earlier lines, so following them ends at a root
+    int path[REPORT_PATH_LENGTH];
+    int length = 0;
+    while (node > 0 && length < REPORT_PATH_LENGTH) {
+        path[length++] = node;
+        if (graph->nodes[node].root != NULL) break;
+        node = findNode(graph, graph->nodes[node].parent);
+    }
+    int top = path[length - 1];
+    if (graph->nodes[top].root != NULL) {
+        printf("%s", graph->nodes[top].root);
+    } else {
+        printf("...");
+    }
+    for (int i = length - 1; i >= 0; i--) {
+        if (i == length - 1 && graph->nodes[top].root != NULL) {
+            printf(": %s", graph->labels[graph->nodes[path[i]].label]);
+        } else {
+            printf(" > %s", graph->labels[graph->nodes[path[i]].label]);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: heapanalyze <heap dump>\n");
+        exit(64);
+    }
+    FILE* file = fopen(argv[1], "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", argv[1]);
+        exit(74);
+    }
+    Graph graph;
+    readGraph(&graph, file, argv[1]);
+    fclose(file);
+
+    Dominators dominators;
+    findDominators(&graph, &dominators);
+    // Postorder puts everything an object dominates before it
+    uint64_t totalBytes = 0;
+    for (int i = 0; i < dominators.reachable; i++) {
+        int node = dominators.postorder[i];
+        if (node == 0) continue;
+        graph.nodes[node].retained += graph.nodes[node].size;
+        totalBytes += graph.nodes[node].size;
+        graph.nodes[dominators.idom[node]].retained += graph.nodes[node].retained;
+    }
+    printf("%d objects, %llu bytes\n\n", graph.count - 1, (unsigned long long)totalBytes);
+
+    ClassTotal* totals = checked(malloc(sizeof(ClassTotal) * (graph.labelCount + 1)));
+    totalClasses(&graph, &dominators, totals);
+    qsort(totals, graph.labelCount, sizeof(ClassTotal), compareClasses);
+    printf("%10s %14s %14s  %s\n", "count", "shallow", "retained", "class");
+    for (int i = 0; i < graph.labelCount && i < REPORT_CLASSES; i++) {
+        printf("%10llu %14llu %14llu  %s\n", (unsigned long long)totals[i].count,
+               (unsigned long long)totals[i].shallow, (unsigned long long)totals[i].retained,
+               graph.labels[totals[i].label]);
+    }
+
+    int* objects = checked(malloc(sizeof(int) * graph.count));
+    for (int i = 1; i < graph.count; i++) objects[i - 1] = i;
+    sortedGraph = &graph;
+    qsort(objects, graph.count - 1, sizeof(int), compareRetained);
+    printf("\nBiggest retainers:\n");
+    int listed = 0;
+    for (int i = 0; i < graph.count - 1 && listed < REPORT_OBJECTS; i++) {
+        Node* node = &graph.nodes[objects[i]];
+        // Only the head of a list, or of any other chain of the same class, rather than every link down from it
+        int idom = dominators.idom[objects[i]];
+        if (idom > 0 && graph.nodes[idom].label == node->label) continue;
+        printf("%14llu  ", (unsigned long long)node->retained);
+        printPath(&graph, objects[i]);
+        listed++;
+    }
+
+    free(objects);
+    free(totals);
+    freeDominators(&dominators);
+    freeGraph(&graph);
+    return 0;
+}